@@ -0,0 +1,190 @@
+// Benchmark: headless core on synthetic opcode-mix ROMs and a public-domain game, interpreter and recompiler.
+// Prints a table, plus one CSV or JSON record per case with --csv/--json [file].
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "headless.h"
+
+#define FRAMES 2000
+#define INSTRUCTIONS_PER_SECOND 600000 // 10000 instructions per frame, so per-frame costs do not hide the core
+
+struct BenchRom {
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+};
+
+// 8XYn on six registers, every ALU operation
+static const uint8_t rom_alu[] = {
+    0x60, 0x13, 0x61, 0x57, 0x62, 0xA9, 0x63, 0x04, 0x64, 0xF0, 0x65, 0x3C, // V0-V5 = ...
+    0x80, 0x14, 0x81, 0x25, 0x82, 0x31, 0x83, 0x42, 0x84, 0x53, 0x85, 0x06, // ADD SUB OR AND XOR SHR
+    0x80, 0x1E, 0x81, 0x27, 0x82, 0x30, 0x83, 0x44, 0x84, 0x55, 0x85, 0x0E, // SHL SUBN LD ADD SUB SHL
+    0x70, 0x01, 0x71, 0x03, 0x40, 0x00, 0x60, 0x13,                         // keep the values moving
+    0x12, 0x0C,                                                             // loop (skips the setup)
+};
+
+// DXYN with growing heights and moving coordinates, most frames collide
+static const uint8_t rom_sprites[] = {
+    0xA0, 0x00, 0x60, 0x00, 0x61, 0x00, // I = font, V0 = V1 = 0
+    0xD0, 0x1F, 0xD1, 0x05, 0xD0, 0x0A, // D01F D105 D01A
+    0x70, 0x05, 0x71, 0x03, 0x72, 0x01, // move
+    0xD2, 0x1F, 0xD0, 0x28,             // D21F D028
+    0x12, 0x06,                         // loop
+};
+
+// Nested call/return chain
+static const uint8_t rom_calls[] = {
+    0x22, 0x10, 0x22, 0x10, 0x22, 0x10, 0x22, 0x10, 0x12, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x22, 0x20, 0x70, 0x01, 0x22, 0x20, 0x00, 0xEE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x71, 0x01, 0x22, 0x28, 0x00, 0xEE, 0x00, 0x00,
+    0x72, 0x01, 0x00, 0xEE,
+};
+
+// FX65/FX55 block copies (and the code cache invalidation they trigger)
+static const uint8_t rom_memory[] = {
+    0xA3, 0x00, // I = 0x300
+    0xFE, 0x65, // V0-VE = [I]
+    0x7E, 0x01,
+    0xFE, 0x55, // [I] = V0-VE
+    0xFE, 0x33, // BCD of VE
+    0x12, 0x00,
+};
+
+// Maze (David Winter, public domain): random diagonal lines until the screen is full
+static const uint8_t rom_maze[] = {
+    0xA2, 0x1E, 0xC2, 0x01, 0x32, 0x01, 0xA2, 0x1A, 0xD0, 0x14, 0x70, 0x04, 0x30, 0x40, 0x12, 0x00,
+    0x60, 0x00, 0x71, 0x04, 0x31, 0x20, 0x12, 0x00, 0x12, 0x18, 0x80, 0x40, 0x20, 0x10, 0x20, 0x40,
+    0x80, 0x10,
+};
+
+static const struct BenchRom roms[] = {
+    { "alu-8xyn", rom_alu, sizeof rom_alu },
+    { "sprites-dxyn", rom_sprites, sizeof rom_sprites },
+    { "call-return", rom_calls, sizeof rom_calls },
+    { "memory-fx55-fx65", rom_memory, sizeof rom_memory },
+    { "game-maze", rom_maze, sizeof rom_maze },
+};
+
+struct BenchResult {
+    const char *rom;
+    const char *cpu;
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t elapsed_ns;
+    uint64_t display_hash;
+};
+
+static bool bench_run(const struct BenchRom *rom, bool jit, struct BenchResult *result) {
+    struct Emulator *emulator = malloc(sizeof(struct Emulator));
+    if (!emulator) return false;
+
+    emulator_initialize(emulator);
+    emulator->instructions_per_second = INSTRUCTIONS_PER_SECOND;
+    emulator->skip_idle_loops = false; // measure the core, not how much of the ROM is idle
+    if (jit) emulator->cpu = CPU_JIT;
+    emulator_load_rom_from_memory(emulator, rom->data, rom->size);
+
+    // One unmeasured frame: recompiler warm-up, page faults
+    emulator_update(emulator);
+    const uint64_t start_frames = emulator->frames_executed;
+    const uint64_t start_instructions = emulator->instructions_executed;
+
+    *result = (struct BenchResult){
+        .rom = rom->name,
+        .cpu = jit ? "jit" : "interp",
+        .elapsed_ns = emulator_headless_run_frames(emulator, FRAMES, 0),
+    };
+    result->frames = emulator->frames_executed - start_frames;
+    result->instructions = emulator->instructions_executed - start_instructions;
+    result->display_hash = emulated_display_hash(&emulator->emulated_system);
+
+    const bool ok = emulator->emulated_system.state != QUIT;
+    emulator_destroy(emulator);
+    free(emulator);
+    return ok;
+}
+
+static double instructions_per_second(const struct BenchResult *result) {
+    return result->elapsed_ns ? result->instructions * 1e9 / result->elapsed_ns : 0;
+}
+
+static double ns_per_frame(const struct BenchResult *result) {
+    return result->frames ? (double)result->elapsed_ns / result->frames : 0;
+}
+
+int main(int argc, char **argv) {
+    enum { FORMAT_NONE, FORMAT_CSV, FORMAT_JSON } format = FORMAT_NONE;
+    const char *output_name = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) format = FORMAT_CSV;
+        else if (strcmp(argv[i], "--json") == 0) format = FORMAT_JSON;
+        else if (argv[i][0] != '-') output_name = argv[i];
+        else {
+            fprintf(stderr, "Usage: %s [--csv|--json] [file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const size_t rom_count = sizeof roms / sizeof roms[0];
+    struct BenchResult results[2 * (sizeof roms / sizeof roms[0])];
+    bool ok = true;
+
+    printf("%-18s %-7s %12s %14s %12s\n", "rom", "cpu", "frames", "instr/s", "ns/frame");
+    for (size_t r = 0; r < rom_count; r++) {
+        for (int jit = 0; jit <= 1; jit++) {
+            struct BenchResult *result = &results[2 * r + jit];
+            if (!bench_run(&roms[r], jit, result)) {
+                fprintf(stderr, "%s stopped before the end of the run\n", roms[r].name);
+                ok = false;
+            }
+            printf("%-18s %-7s %12llu %14.0f %12.0f\n", result->rom, result->cpu,
+                   (long long unsigned)result->frames, instructions_per_second(result), ns_per_frame(result));
+        }
+
+        // Both engines must agree, or the numbers are not comparable
+        if (results[2 * r].display_hash != results[2 * r + 1].display_hash
+            || results[2 * r].instructions != results[2 * r + 1].instructions) {
+            fprintf(stderr, "%s: interpreter and recompiler disagree\n", roms[r].name);
+            ok = false;
+        }
+    }
+
+    if (format == FORMAT_NONE) return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    FILE *output = output_name ? fopen(output_name, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "Could not open %s\n", output_name);
+        return EXIT_FAILURE;
+    }
+
+    if (format == FORMAT_CSV) fprintf(output, "rom,cpu,frames,instructions,elapsed_ns,instructions_per_second,ns_per_frame,display_hash\n");
+    else fprintf(output, "[\n");
+    for (size_t i = 0; i < 2 * rom_count; i++) {
+        const struct BenchResult *result = &results[i];
+        if (format == FORMAT_CSV) {
+            fprintf(output, "%s,%s,%llu,%llu,%llu,%.0f,%.0f,%016llx\n", result->rom, result->cpu,
+                    (long long unsigned)result->frames, (long long unsigned)result->instructions,
+                    (long long unsigned)result->elapsed_ns, instructions_per_second(result), ns_per_frame(result),
+                    (long long unsigned)result->display_hash);
+        }
+        else {
+            fprintf(output, "  {\"rom\": \"%s\", \"cpu\": \"%s\", \"frames\": %llu, \"instructions\": %llu, "
+                            "\"elapsed_ns\": %llu, \"instructions_per_second\": %.0f, \"ns_per_frame\": %.0f, "
+                            "\"display_hash\": \"%016llx\"}%s\n",
+                    result->rom, result->cpu, (long long unsigned)result->frames,
+                    (long long unsigned)result->instructions, (long long unsigned)result->elapsed_ns,
+                    instructions_per_second(result), ns_per_frame(result), (long long unsigned)result->display_hash,
+                    i + 1 < 2 * rom_count ? "," : "");
+        }
+    }
+    if (format == FORMAT_JSON) fprintf(output, "]\n");
+    if (output != stdout) fclose(output);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
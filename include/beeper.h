@@ -0,0 +1,34 @@
+// Beeper: the emulation thread queues the sound timer state of every frame, the audio callback turns it into a
+// band-limited square wave (or the XO-CHIP audio pattern). One producer and one consumer, no locks; the audio
+// device is paused only while the emulation is (paused or idle), the frame gap on resume restarts the queue.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulated.h" // AUDIO_PATTERN_SIZE
+
+#define BEEPER_DEFAULT_BUFFER_SAMPLES 512
+
+// buffer_samples is the size of one audio device buffer; it sets how many frames are queued ahead (the latency)
+struct Beeper *emulator_beeper_create(uint32_t sample_rate, uint32_t tone_frequency, int16_t volume, uint32_t buffer_samples);
+
+void emulator_beeper_destroy(struct Beeper *beeper);
+
+// Producer side (emulation thread). frame is the number of the frame that just ended; a gap in the numbers
+// (pause, rewind, state load) makes the consumer wait until a few frames are queued again. pattern is the
+// XO-CHIP audio pattern (AUDIO_PATTERN_SIZE bytes) played at pitch, or NULL for the square wave.
+void emulator_beeper_push(struct Beeper *beeper, uint64_t frame, bool on, const uint8_t *pattern, uint8_t pitch);
+
+// Any thread
+void emulator_beeper_set_volume(struct Beeper *beeper, int16_t volume);
+void emulator_beeper_set_muted(struct Beeper *beeper, bool muted); // queued frames are dropped while muted
+
+// Consumer side (audio callback): writes count mono samples
+void emulator_beeper_render(struct Beeper *beeper, int16_t *samples, size_t count);
+
+// Frames the consumer found missing (underruns) or dropped to keep the latency bounded
+uint64_t emulator_beeper_underruns(const struct Beeper *beeper);
+uint64_t emulator_beeper_dropped(const struct Beeper *beeper);
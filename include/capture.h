@@ -0,0 +1,31 @@
+// Video capture: the emulator queues the display of every frame, a background thread turns it into pixels and
+// writes them out. No frame is ever dropped: when the writer falls CAPTURE_QUEUE_FRAMES behind, the emulator
+// blocks until a slot frees, so a slow disk slows the emulation down; how often that happened is printed on close.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulated.h"
+
+#define CAPTURE_QUEUE_FRAMES 256 // a bit over 4 s at 60hz
+#define CAPTURE_DEFAULT_PALETTE { 0x000000FF, 0xFFFFFFFF, 0xFF6600FF, 0x662200FF } // as the window: 0xRRGGBBAA
+
+/*
+ * The format follows the file name:
+ *   .y4m   YUV4MPEG2, 60 fps, 4:4:4 (no chroma loss on the pixel edges), plays in mpv/ffplay, ffmpeg encodes it
+ *   .png   one PNG per frame, the number inserted before the extension (out.png: out-000000.png, ...); stored
+ *          without compression, so no zlib is needed
+ *   other  raw RGBA, frame after frame (ffmpeg -f rawvideo -pix_fmt rgba -s WxH -r 60 -i FILE)
+ * Frames are width x height pixels times scale. width and height are the machine's largest resolution (64x32 for
+ * CHIP-8, 128x64 otherwise), so the size never changes; low resolution pixels are doubled on a 128x64 canvas.
+ * palette holds the colors of a clear pixel, one of the first plane, of the second and of both.
+ */
+struct Capture *emulator_capture_open(const char *filename, uint32_t width, uint32_t height, uint32_t scale, const uint32_t palette[4]);
+
+// Queues the display of the frame that just ended
+void emulator_capture_frame(struct Capture *capture, const struct EmulatedSystem *emulated_system);
+
+// Writes what is queued, stops the writer thread and closes the output; false if something was not written
+bool emulator_capture_close(struct Capture *capture);
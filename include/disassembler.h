@@ -0,0 +1,17 @@
+// Disassembler: opcode text for reports and traces, opcode classes for statistics
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One class per instruction form ("8XY4", "DXYN", ...), the last one is for invalid opcodes
+#define OPCODE_CLASS_COUNT 52
+
+uint8_t emulator_opcode_class(uint16_t opcode);
+
+// Opcode pattern of a class, e.g. "FX1E"
+const char *emulator_opcode_class_name(uint8_t opcode_class);
+
+// Writes the mnemonic form of opcode, e.g. "ADD V1, V2"
+void emulator_disassemble(uint16_t opcode, char *text, size_t size);
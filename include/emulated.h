@@ -3,12 +3,26 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define STACK_SIZE 12
+#define RAM_SIZE 65536 // XO-CHIP; CHIP-8 and SUPER-CHIP programs only see the first CHIP8_RAM_SIZE bytes
+#define RAM_MASK (RAM_SIZE - 1)
+#define CHIP8_RAM_SIZE 4096
+#define DISPLAY_WIDTH 128 // SUPER-CHIP hi-res; low resolution (64x32) uses the top-left quarter
+#define DISPLAY_HEIGHT 64
+#define DISPLAY_WORDS (DISPLAY_WIDTH / 64) // per row
+#define DISPLAY_PLANES 2 // XO-CHIP bitplanes; CHIP-8 and SUPER-CHIP only draw on the first
+#define RPL_FLAGS 16
+#define AUDIO_PATTERN_SIZE 16 // XO-CHIP audio pattern, 128 one-bit samples
+#define AUDIO_DEFAULT_PITCH 64 // 4000 samples per second
 
 // From emulated.c
 extern const uint32_t emulated_system_entry_point;
-extern const uint8_t emulated_system_font[16][5];
+extern const uint8_t emulated_system_font[16 * 5];
+extern const uint32_t emulated_system_large_font_address;
+extern const uint8_t emulated_system_large_font[16 * 10]; // SUPER-CHIP 8x10 digits (FX30)
 
 struct Instruction {
   uint16_t opcode; // 1º half-byte
@@ -25,22 +39,52 @@ struct EmulatedSystem {
     RUNNING,
     PAUSE,
   } state;
-  uint8_t ram[4096]; // 4 kilobytes of fully writable RAM
-  bool display[64*32]; // 64x32 pixels, each can be on or off (boolean)
+  uint8_t ram[RAM_SIZE]; // fully writable RAM: 4 kilobytes, 64 for XO-CHIP
+  uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS]; // one bit per pixel; bit 63 of word 0 is the leftmost pixel
+  uint8_t planes; // bitmask of the planes drawn, cleared and scrolled (XO-CHIP FN01), 1 otherwise
+  bool hires; // SUPER-CHIP 128x64 mode; otherwise only the 64x32 top-left quarter is used (the rest stays clear)
   uint16_t stack[STACK_SIZE]; // stores 16-bit adresses, used for function call and return
-  uint16_t *stack_ptr;
+  uint8_t stack_depth; // return addresses on the stack; the next call writes stack[stack_depth]
   uint8_t V[16]; // general-purpose registers
   uint16_t I; // points at some location in memory
   uint16_t PC; // points at the current instruction in memory
   uint8_t delay_timer; // decrements at the rate of 60hz (60 times per second until reaches 0)
   uint8_t sound_timer; // like the delay_timer
   bool keypad[16];
-  const char *rom_name;
-  struct Instruction instruction;
+  uint8_t awaited_key; // key pressed during FX0A, reported when released (0xFF = none yet)
+  uint64_t random_state; // CXNN generator, per instance so runs are reproducible
+  uint8_t rpl[RPL_FLAGS]; // SUPER-CHIP RPL user flags (FX75/FX85)
+  uint8_t audio_pattern[AUDIO_PATTERN_SIZE]; // XO-CHIP F002, played instead of the beep once loaded
+  bool has_audio_pattern;
+  uint8_t pitch; // XO-CHIP FX3A, the pattern plays at 4000 * 2 ^ ((pitch - 64) / 48) samples per second
+  uint32_t rom_crc; // CRC-32 of the loaded ROM, checked when a save state is loaded
 };
 
-// Writes struct Emulator->EmulatedSystem data to a binary file
-bool emulated_save_state(struct EmulatedSystem *emulated_system, const char *filename);
+// Size of the display in the current mode
+static inline uint32_t emulated_display_width(const struct EmulatedSystem *emulated_system) {
+  return emulated_system->hires ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+}
 
-// Loads data from a binary file to Emulator->EmulatedSystem
-bool emulated_load_state(struct EmulatedSystem *emulated_system, const char *filename);
\ No newline at end of file
+static inline uint32_t emulated_display_height(const struct EmulatedSystem *emulated_system) {
+  return emulated_system->hires ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+}
+
+// Seeds the per-instance random generator used by CXNN
+void emulated_seed_random(struct EmulatedSystem *emulated_system, uint64_t seed);
+
+// Next random byte (splitmix64)
+uint8_t emulated_random(struct EmulatedSystem *emulated_system);
+
+// 64-bit FNV-1a hash of the display, to compare runs cheaply
+uint64_t emulated_display_hash(const struct EmulatedSystem *emulated_system);
+
+// CRC-32 (IEEE 802.3), used for ROM hashes and save state checksums
+uint32_t emulated_crc32(const uint8_t *data, size_t length);
+
+// Writes the machine state to a binary file (versioned, tagged chunks, little-endian, CRC-32 protected);
+// ram_size is the memory the program can address, only that much RAM is saved
+bool emulated_save_state(const struct EmulatedSystem *emulated_system, uint32_t ram_size, const char *filename);
+
+// Loads a save state written by emulated_save_state; the machine is left untouched if the file is
+// damaged, from an unknown version, made with a different ROM or for a machine with another ram_size
+bool emulated_load_state(struct EmulatedSystem *emulated_system, uint32_t ram_size, const char *filename);
\ No newline at end of file
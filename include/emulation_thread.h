@@ -0,0 +1,74 @@
+// Emulation thread: runs the emulator paced by the scheduler, away from the thread that draws and presents.
+// Completed frames are published through a lock-free triple buffer, the front-end's input arrives through
+// atomics; neither side ever waits for the other. While paused or idle the emulation thread sleeps on a condition
+// variable instead of ticking, until emulator_controls_wake().
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "emulator.h"
+
+// What the front-end needs to draw a frame
+struct FrameSnapshot {
+  uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+  bool hires;
+  bool sound; // sound timer active
+  uint64_t frame; // frames_executed when it was taken
+  double measured_instructions_per_second; // over the last second, see scheduler.h
+  uint32_t instructions_per_second; // target
+};
+
+#define EMULATION_DEFAULT_INPUT_SLICES 4
+
+// Written by the front-end, read by the emulation thread before each pass (the keypad, as instructions run)
+struct EmulationControls {
+  struct EmulatorInput input;
+  _Atomic bool quit; // also set by the emulation thread when the ROM quits
+  _Atomic bool paused;
+  _Atomic bool idle; // front-end asleep (minimized, unfocused), frames are not run
+  _Atomic bool rewinding; // one frame back per 60hz tick instead of emulating
+  _Atomic bool fast_forward;
+  _Atomic uint32_t fast_forward_multiplier; // emulated frames per tick, 0 = as many as fit in one
+  _Atomic bool save_state; // requests, cleared once handled
+  _Atomic bool load_state;
+  pthread_mutex_t lock; // only for the sleep while paused or idle
+  pthread_cond_t resume;
+};
+
+// Wakes the emulation thread if it sleeps; call after changing a control that can end a pause or idle sleep
+// (paused, idle, rewinding, quit, the requests)
+void emulator_controls_wake(struct EmulationControls *controls);
+
+struct EmulationThread {
+  struct Emulator *emulator; // owned by the thread until emulator_thread_stop()
+  struct EmulationControls controls;
+  uint32_t input_slices; // parts each frame's instructions are spread over, the input is seen between them
+
+  // Triple buffer: the producer fills back, then swaps it with middle; the consumer swaps front with middle
+  // when middle holds a frame it did not see yet (SNAPSHOT_FRESH)
+  struct FrameSnapshot snapshots[3];
+  _Atomic uint32_t middle;
+  uint32_t back; // producer only
+  uint32_t front; // consumer only
+  bool has_frame; // consumer only, something was published
+
+  pthread_t thread;
+};
+
+// Sets up the controls (nothing pressed, running) and an empty triple buffer; the controls may be changed before
+// the thread starts
+void emulator_thread_initialize(struct EmulationThread *thread, struct Emulator *emulator);
+
+// Starts emulating on a new thread; false on error. The emulator must not be touched until it stops.
+bool emulator_thread_start(struct EmulationThread *thread);
+
+// Newest published frame (NULL before the first one); fresh tells whether it was published since the last call.
+// The snapshot stays valid until the next call.
+const struct FrameSnapshot *emulator_thread_latest_frame(struct EmulationThread *thread, bool *fresh);
+
+// Asks the thread to quit and waits for it; the emulator belongs to the caller again
+void emulator_thread_stop(struct EmulationThread *thread);
@@ -2,15 +2,55 @@
 
 #pragma once
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "emulated.h"
-#include "user_interface/sdl/interface.h"
+
+struct Emulator;
+
+// Executes one decoded instruction; returns true when the display was modified
+typedef bool (*InstructionHandler)(struct Emulator *emulator, const struct Instruction *instruction);
+
+struct DecodedInstruction;
+
+// Executes a superinstruction (a common sequence of instructions, fused) starting at decoded; returns how many
+// of its instructions ran, fewer when a skip jumped over the rest
+typedef uint32_t (*FusedHandler)(struct Emulator *emulator, const struct DecodedInstruction *decoded);
+
+#define FUSED_MAX_INSTRUCTIONS 3
+
+struct DecodedInstruction {
+  InstructionHandler handler; // NULL while the address was not decoded yet (or was overwritten)
+  struct Instruction instruction; // operands, extracted once
+  // superinstruction starting here: fused_length 0 = not looked for yet, 1 = none, else its instruction count.
+  // Only the interpreter loop runs it; a jump into the middle of the sequence finds the plain instruction there.
+  uint8_t fused_length;
+  FusedHandler fused;
+};
+
+// Live input: written by the front-end from any thread, read the moment EX9E, EXA1 and FX0A run (and at the
+// start of each run of instructions, for compiled code)
+struct EmulatorInput {
+  _Atomic uint16_t keypad; // bit k = key k pressed
+
+  // Latency measurement: the front-end stores when each key went down (emulator_headless_now_ns()), the first
+  // instruction that sees it pressed takes the difference
+  bool measure_latency;
+  _Atomic uint64_t pressed_ns[16]; // 0 = nothing to measure
+  uint64_t latency_samples; // written by the emulation only
+  uint64_t latency_total_ns;
+  uint64_t latency_max_ns;
+};
 
 struct Emulator {
-  // how many instructions are executed each second.
+  // how many instructions are executed each second, any value: the frames that do not divide it evenly carry
+  // the rest (instruction_remainder, in 1/60ths of an instruction) to the next one
   uint32_t instructions_per_second;
+  uint32_t instruction_remainder;
+  uint64_t frame_instructions_left; // of the frame being run, see emulator_begin_frame()
 
   // virtual machine specifications
   enum {
@@ -22,23 +62,91 @@ struct Emulator {
   // represents the system that will be emulated
   struct EmulatedSystem emulated_system;
 
-  // handles the user interaction with the emulated system (audio, video, keypresses)
-  struct UserInterface user_interface;
-
   const char *rom_name; // binary file loaded into the virtual machine
+
+  // decoded instruction cache, indexed by the address (PC) of the instruction
+  struct DecodedInstruction decoded_instructions[RAM_SIZE];
+
+  // execution engine; the recompiler falls back to the interpreter for what it can not translate
+  enum {
+    CPU_INTERPRETER,
+    CPU_JIT,
+  } cpu;
+  struct Jit *jit; // created on first use when cpu == CPU_JIT
+
+  struct Rewind *rewind; // optional, captures every frame at the end of emulator_update()
+  struct Movie *movie; // optional, records or replays the keypad at the start of emulator_update()
+  struct Beeper *beeper; // optional, receives the sound state of every frame at the end of emulator_update()
+  struct Capture *capture; // optional, receives the display of every frame at the end of emulator_update()
+  struct EmulatorInput *input; // optional, otherwise the keypad is whatever the front-end writes between frames
+  // optional instrumentation; while either is set, frames run on an instrumented copy of the interpreter loop
+  struct Profile *profile;
+  struct Trace *trace;
+
+  // set at the end of each frame while the sound timer is active; read by the front-end
+  bool should_play_sound;
+
+  // Idle loops (a jump to itself, FX07 / 3XNN / 1NNN waiting for the delay timer, FX0A waiting for a key) change
+  // nothing until the next timer tick or key event, so the rest of the frame's instructions are counted without
+  // being run. The instrumented loop (profile, trace) never skips.
+  bool skip_idle_loops; // on by default
+  uint8_t idle_loop_length; // instructions in the loop the machine just entered, 0 = not idle
+
+  // statistics, useful to measure interpreter throughput
+  uint64_t instructions_executed;
+  uint64_t frames_executed;
+  uint64_t instructions_skipped; // part of instructions_executed that idle loop detection did not run
 };
 
-// Loads binary file to emulated system memory
+// Memory the program can address: 4 kilobytes, 64 for XO-CHIP (addresses wrap around it)
+static inline uint32_t emulator_ram_size(const struct Emulator *emulator) {
+  return emulator->extension == XOCHIP ? RAM_SIZE : CHIP8_RAM_SIZE;
+}
+
+// Length of the instruction at address, which skips jump over whole: XO-CHIP F000 NNNN takes four bytes
+static inline uint16_t emulator_instruction_length(const struct Emulator *emulator, uint16_t address) {
+  const uint8_t *ram = emulator->emulated_system.ram;
+  return emulator->extension == XOCHIP && ram[address] == 0xF0 && ram[(address + 1) & RAM_MASK] == 0x00 ? 4 : 2;
+}
+
+// Loads binary file to emulated system memory (up to the memory of the extension, so set it first)
 bool emulator_load_rom(struct Emulator *emulator, const char* rom_name);
 
+// Same, for a ROM already in memory (benchmarks, embedded test programs)
+bool emulator_load_rom_from_memory(struct Emulator *emulator, const uint8_t *rom, size_t rom_size);
+
 // Initializes emulator
 bool emulator_initialize(struct Emulator *emulator);
 
-// Performs interpretation cycle
+// Performs interpretation cycle (one 60hz frame: instructions + timers), without any pacing
 void emulator_update(struct Emulator *emulator);
 
+// The same frame in parts, so that a front-end can spread its instructions over the frame time and let them see
+// input in between: begin, any number of runs, end (which runs what is left of the frame's instructions)
+void emulator_begin_frame(struct Emulator *emulator);
+void emulator_run_instructions(struct Emulator *emulator, uint64_t count);
+void emulator_end_frame(struct Emulator *emulator);
+
 // Consumes and emulates an instruction
 bool emulator_emulate_instruction(struct Emulator *emulator);
 
+// The same without the decode cache (every instruction is decoded again), for verify.c: no superinstructions,
+// compiled code or idle loop skipping either
+bool emulator_emulate_instruction_reference(struct Emulator *emulator);
+
+// Drops decoded instructions overlapping the RAM range [address, address + length)
+void emulator_invalidate_decoded_instructions(struct Emulator *emulator, uint16_t address, uint16_t length);
+
+// Saves/loads the emulated system state, keeping emulator caches coherent
+bool emulator_save_state(struct Emulator *emulator, const char *filename);
+bool emulator_load_state(struct Emulator *emulator, const char *filename);
+
+// Replaces the emulated system with a copy of emulated_system, dropping decoded and compiled code
+void emulator_restore_system(struct Emulator *emulator, const struct EmulatedSystem *emulated_system);
+
+// Goes back one frame in the rewind buffer, keeping emulator caches coherent; false when there is no history
+// (or while a movie is recorded or played, since it would no longer match the run)
+bool emulator_rewind(struct Emulator *emulator);
+
 // Destroys struct Emulator
 void emulator_destroy(struct Emulator *emulator);
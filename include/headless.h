@@ -0,0 +1,19 @@
+// Headless runner (no window, no audio, no frame pacing)
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulator.h"
+
+// Monotonic clock, in nanoseconds
+uint64_t emulator_headless_now_ns(void);
+
+// Runs frames back to back until the ROM quits or a limit (0 = unlimited) is reached; the instruction
+// limit is checked between frames. Returns the elapsed wall time in nanoseconds.
+uint64_t emulator_headless_run_frames(struct Emulator *emulator, uint64_t max_frames, uint64_t max_instructions);
+
+// Runs the emulator as fast as possible until the ROM quits or max_frames (0 = unlimited) frames are emulated,
+// then reports the measured throughput (instructions per second) on stdout
+void emulator_headless_run(struct Emulator *emulator, uint64_t max_frames);
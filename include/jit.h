@@ -0,0 +1,23 @@
+// Dynamic recompiler (x86-64): translates straight-line CHIP-8 blocks to native code
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulator.h"
+
+// Allocates the recompiler state (code buffer and block table); NULL when unsupported on this host
+struct Jit *emulator_jit_create(void);
+
+void emulator_jit_destroy(struct Jit *jit);
+
+// Runs the block starting at PC if it fits in the instruction budget.
+// Returns how many instructions were executed; 0 means the interpreter must execute the next instruction.
+uint32_t emulator_jit_execute(struct Emulator *emulator, uint64_t budget);
+
+// Drops compiled code that may include the RAM range [address, address + length)
+void emulator_jit_invalidate(struct Jit *jit, uint16_t address, uint16_t length);
+
+// Drops all compiled code
+void emulator_jit_flush(struct Jit *jit);
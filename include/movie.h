@@ -0,0 +1,30 @@
+// Input movies: keypad changes per frame plus everything else a run depends on (ROM, seed, speed)
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulator.h"
+
+// Starts recording a run that has not emulated any frame yet; NULL if the file can not be created
+struct Movie *emulator_movie_record(const char *filename, const struct Emulator *emulator);
+
+// Loads a movie for playback and applies its seed, speed and extension to emulator; NULL if it is invalid.
+// Called before the ROM is loaded, since the extension sets how large a ROM can be.
+struct Movie *emulator_movie_play(const char *filename, struct Emulator *emulator);
+
+// Playback: true if the movie was recorded with the ROM whose CRC-32 is rom_crc
+bool emulator_movie_matches_rom(const struct Movie *movie, uint32_t rom_crc);
+
+// Called at the start of every frame: records the keypad, or replaces it with the recorded one
+void emulator_movie_frame(struct Movie *movie, struct EmulatedSystem *emulated_system);
+
+// Playback: true once every recorded frame was replayed (input goes back to the user)
+bool emulator_movie_finished(const struct Movie *movie);
+
+// Frames recorded so far, or held by the movie being played
+uint64_t emulator_movie_length(const struct Movie *movie);
+
+// Finishes the file when recording; returns false if it could not be written
+bool emulator_movie_close(struct Movie *movie);
@@ -0,0 +1,33 @@
+// Execution profiler: opcode mix, hot PCs and time spent drawing, per emulator instance
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "disassembler.h"
+#include "emulated.h"
+
+struct Profile {
+  uint64_t pc_counts[RAM_SIZE]; // executions per address
+  uint64_t class_counts[OPCODE_CLASS_COUNT]; // executions per instruction form
+  uint64_t instructions;
+  uint64_t frames;
+  uint64_t emulation_ns; // wall time inside emulator_update()
+  uint64_t draw_ns; // wall time inside DXYN/00E0
+  uint64_t draws;
+};
+
+struct Profile *emulator_profile_create(void);
+
+void emulator_profile_destroy(struct Profile *profile);
+
+// Counts one instruction, before it is executed
+static inline void emulator_profile_count(struct Profile *profile, uint16_t PC, uint16_t opcode) {
+  profile->pc_counts[PC]++;
+  profile->class_counts[emulator_opcode_class(opcode)]++;
+  profile->instructions++;
+}
+
+// Prints the opcode mix, drawing time and the top hot addresses (disassembled from the current RAM)
+void emulator_profile_report(const struct Profile *profile, const struct EmulatedSystem *emulated_system, FILE *output, uint32_t top);
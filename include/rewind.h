@@ -0,0 +1,28 @@
+// Rewind buffer: per-frame snapshots of the emulated system, delta-compressed against periodic keyframes
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulated.h"
+
+#define REWIND_DEFAULT_SECONDS 600
+#define REWIND_DEFAULT_MEMORY (16 * 1024 * 1024)
+
+// Keeps up to max_frames snapshots in at most memory_limit bytes; the oldest ones are dropped first
+struct Rewind *emulator_rewind_create(uint32_t max_frames, size_t memory_limit);
+
+void emulator_rewind_destroy(struct Rewind *rewind);
+
+// Stores the state of the frame that just ended
+void emulator_rewind_capture(struct Rewind *rewind, const struct EmulatedSystem *emulated_system);
+
+// Drops the newest snapshot and writes the one before it into emulated_system (keypad and run state are kept).
+// Returns false when there is nothing left to go back to.
+bool emulator_rewind_restore(struct Rewind *rewind, struct EmulatedSystem *emulated_system);
+
+// Snapshots held and bytes of snapshot data in use
+uint32_t emulator_rewind_frames(const struct Rewind *rewind);
+size_t emulator_rewind_memory_used(const struct Rewind *rewind);
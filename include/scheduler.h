@@ -0,0 +1,40 @@
+// Frame scheduler: paces emulator_update() at 60 frames per second of wall time, on the monotonic clock
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHEDULER_FRAME_RATE 60
+#define SCHEDULER_MAX_CATCH_UP 4 // frames run at once after a hiccup, beyond that they are given up
+
+struct Scheduler {
+  uint64_t origin_ns; // when frame 0 of the timeline is due
+  uint64_t frames; // frames handed out since origin, also the number of the next one
+
+  // measured speed, over windows of about one second
+  uint64_t window_start_ns;
+  uint64_t window_instructions; // instructions executed when the window started
+  double measured_instructions_per_second;
+};
+
+// Starts a timeline whose first frame is due now; instructions_executed starts the first measurement window
+void emulator_scheduler_start(struct Scheduler *scheduler, uint64_t now_ns, uint64_t instructions_executed);
+
+// Starts a new timeline (after a pause, or anything else that did not run frames) without a burst of late frames
+void emulator_scheduler_restart(struct Scheduler *scheduler, uint64_t now_ns);
+
+// Frames due since the last call (usually 0 or 1), at most SCHEDULER_MAX_CATCH_UP
+uint32_t emulator_scheduler_frames_due(struct Scheduler *scheduler, uint64_t now_ns);
+
+// When frame (of the current timeline) is due
+uint64_t emulator_scheduler_deadline(const struct Scheduler *scheduler, uint64_t frame);
+
+// Sleeps until the next frame is due
+void emulator_scheduler_wait(const struct Scheduler *scheduler);
+
+// Sleeps until the monotonic clock reaches deadline_ns
+void emulator_scheduler_sleep_until(uint64_t deadline_ns);
+
+// Updates measured_instructions_per_second once per window; true when it changed
+bool emulator_scheduler_measure(struct Scheduler *scheduler, uint64_t now_ns, uint64_t instructions_executed);
@@ -0,0 +1,112 @@
+// Execution trace: one record per instruction in a lock-free ring, written to a binary file by a background thread.
+// Neither side polls: the writer sleeps until a quarter of the ring is filled (or TRACE_FLUSH_MS pass), the emulator
+// only takes the lock to wake it and, when the ring is full, to sleep until the writer frees room.
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "emulated.h"
+
+/*
+ * File: "TC8T", u16 version, u16 record size, then records (8 bytes, little-endian hosts).
+ * An instruction record holds PC, opcode, I, VX and VF after it ran: every instruction writes at most those
+ * two registers, except FX65, which is followed by ceil((X + 1) / 6) TRACE_MORE_VALUES records holding
+ * V0-VX in their 6 bytes after PC (as are SUPER-CHIP FX85 and XO-CHIP 5XY3, up to the highest register they load).
+ * Which registers were really written follows from the opcode (see tracua-chip8-tracedump).
+ * TRACE_FRAME marks the start of a frame: opcode | I << 16 = frame number, VX = delay timer, VF = sound timer.
+ */
+#define TRACE_VERSION 1
+#define TRACE_FRAME 0xFFFF
+#define TRACE_MORE_VALUES 0xFFFE
+#define TRACE_FLUSH_MS 10 // the file trails the emulator by at most about this much
+
+struct TraceRecord {
+  uint16_t PC; // address of the instruction
+  uint16_t opcode;
+  uint16_t I;
+  uint8_t VX;
+  uint8_t VF;
+};
+
+struct Trace {
+  struct TraceRecord *records;
+  uint64_t capacity; // power of two
+  uint64_t write_index; // producer's copy of head
+  uint64_t known_tail; // producer's last view of tail, refreshed only when the ring looks full
+  uint64_t next_wake; // write_index at which the producer wakes the writer next
+  _Atomic uint64_t head; // records written by the emulator
+  _Atomic uint64_t tail; // records flushed to the file
+  _Atomic bool stop;
+  uint64_t stalls; // times the emulator waited for the writer
+  pthread_mutex_t lock; // only for sleeping and waking, the records never go through it
+  pthread_cond_t filled; // the writer sleeps on it: a quarter of the ring is waiting, or stop
+  pthread_cond_t freed; // the emulator sleeps on it while the ring is full
+  bool failed; // a write did not complete (writer thread)
+  FILE *file;
+  pthread_t writer;
+};
+
+// Starts tracing to filename with a ring of capacity records (rounded up to a power of two); NULL on error
+struct Trace *emulator_trace_open(const char *filename, uint64_t capacity);
+
+// Flushes what is left, stops the writer thread and closes the file; false if something was not written
+bool emulator_trace_close(struct Trace *trace);
+
+// Waits for the writer to make room (the ring is full)
+void emulator_trace_wait(struct Trace *trace);
+
+// Wakes the writer, a quarter of the ring was filled since the last time
+void emulator_trace_wake(struct Trace *trace);
+
+static inline struct TraceRecord *emulator_trace_reserve(struct Trace *trace) {
+  if (trace->write_index - trace->known_tail >= trace->capacity) emulator_trace_wait(trace);
+  return &trace->records[trace->write_index & (trace->capacity - 1)];
+}
+
+static inline void emulator_trace_commit(struct Trace *trace) {
+  atomic_store_explicit(&trace->head, ++trace->write_index, memory_order_release);
+  if (trace->write_index == trace->next_wake) emulator_trace_wake(trace);
+}
+
+// Highest register loaded from memory by FX65, FX85 and 5XY3 (followed by TRACE_MORE_VALUES records), -1 otherwise
+static inline int emulator_trace_loaded_registers(uint16_t opcode) {
+  const uint8_t X = (opcode >> 8) & 0x0F, Y = (opcode >> 4) & 0x0F;
+  if ((opcode & 0xF0FF) == 0xF065 || (opcode & 0xF0FF) == 0xF085) return X;
+  if ((opcode & 0xF00F) == 0x5003) return X > Y ? X : Y;
+  return -1;
+}
+
+// Records one executed instruction, with the machine as it is after it. Branch-free but for register loads.
+static inline void emulator_trace_instruction(struct Trace *trace, uint16_t PC, uint16_t opcode, const struct EmulatedSystem *emulated_system) {
+  struct TraceRecord *record = emulator_trace_reserve(trace);
+  const uint8_t X = (opcode >> 8) & 0x0F;
+
+  record->PC = PC;
+  record->opcode = opcode;
+  record->I = emulated_system->I;
+  record->VX = emulated_system->V[X];
+  record->VF = emulated_system->V[0xF];
+  emulator_trace_commit(trace);
+
+  const int last = emulator_trace_loaded_registers(opcode);
+  if (last >= 0) {
+    for (int first = 0; first <= last; first += 6) {
+      uint8_t values[6] = {0};
+      memcpy(values, &emulated_system->V[first], first + 6 <= 16 ? 6 : 16 - first);
+
+      record = emulator_trace_reserve(trace);
+      record->PC = TRACE_MORE_VALUES;
+      memcpy((uint8_t *)record + 2, values, sizeof values);
+      emulator_trace_commit(trace);
+    }
+  }
+}
+
+// Marks the start of a frame
+void emulator_trace_frame(struct Trace *trace, uint64_t frame, const struct EmulatedSystem *emulated_system);
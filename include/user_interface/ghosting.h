@@ -0,0 +1,17 @@
+// Phosphor "ghosting" effect: pixel colors fade towards the color of their display bit (no SDL needed)
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Moves each channel of every pixel_color one step of rate (0.0 to 1.0) towards the palette color of its display
+// bits, in fixed-point: palette[0] when clear, [1] for a pixel of display, [2] for one of display2 (the second
+// XO-CHIP plane, may be NULL), [3] for both. The displays hold width / 64 words per row, bit 63 is the leftmost
+// pixel; width must be a multiple of 64. Returns a mask with bit y set when some color of row y changed.
+uint64_t emulator_ghosting_step(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                uint32_t width, uint32_t height, const uint32_t palette[4], float rate);
+
+// Portable implementation, also the reference for the vectorized ones (which must give identical results)
+uint64_t emulator_ghosting_step_scalar(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                       uint32_t width, uint32_t height, const uint32_t palette[4], float rate);
@@ -4,31 +4,69 @@
 
 #include <SDL2/SDL.h>
 
-#include "emulated.h"
+#include "emulation_thread.h"
 
 struct UserInterface {
   uint32_t desired_window_width;
   uint32_t desired_window_height;
   uint32_t fg_color;
   uint32_t bg_color;
+  uint32_t plane2_color; // XO-CHIP: pixels only on the second plane
+  uint32_t blend_color; // and on both planes
   uint32_t scale_factor;
   bool pixel_outlines;
   uint32_t square_wave_freq;
   uint32_t audio_sample_rate;
+  uint32_t audio_buffer_samples; // per device callback; smaller is lower latency (power of two)
   int16_t volume;
   float color_lerp_rate;
   SDL_Window *window;
   SDL_Renderer *renderer;
+  SDL_Texture *texture; // streaming, rows are uploaded only when they change
+  uint32_t texture_scale; // texels per hi-res pixel side (1, or scale_factor / 2 when drawing outlines)
+  uint32_t *texture_row; // staging buffer for one display row
+  uint64_t drawn_display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS]; // display rows currently in the texture
+  bool drawn_hires; // resolution of the texture contents
+  bool texture_valid;
   SDL_AudioSpec want, have;
   SDL_AudioDeviceID dev;
-  uint32_t pixel_color[64*32];
-  uint64_t expected_moment_to_draw;
-  bool should_play_sound;
+  bool audio_paused; // while the emulation is paused or idle
+  struct Beeper *beeper; // the emulator's, created by emulator_user_interface_initialize()
+  uint32_t pixel_color[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+  double shown_instructions_per_second; // in the window title
+
+  // idle mode: emulation stops and the thread sleeps in SDL_WaitEventTimeout until some event arrives
+  bool idle_when_paused;
+  bool idle_when_minimized;
+  bool idle_when_unfocused;
+  bool minimized;
+  bool focused;
+
+  // the front-end's side of the emulation controls
+  bool paused;
+  uint16_t keypad; // bit k = key k pressed
+
+  bool rewinding; // Backspace held: the emulation steps back one frame per tick instead of emulating
+
+  // fast-forward (Tab): several emulated frames per drawn frame, audio muted
+  bool fast_forward;
+  uint32_t fast_forward_multiplier; // emulated frames per tick, 0 = as many as fit in one
 };
 
-uint32_t emulator_user_interface_color_lerp(const uint32_t start_color, const uint32_t end_color, const float t);
 void emulator_user_interface_destroy(struct UserInterface *user_interface);
 void emulator_user_interface_clear_screen(struct UserInterface *user_interface);
 void emulator_user_interface_audio_callback(void *userdata, uint8_t *stream, int len);
-bool emulator_user_interface_initialize(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system);
-void emulator_user_interface_update(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system);
\ No newline at end of file
+void emulator_user_interface_set_defaults(struct UserInterface *user_interface);
+// Runs before the emulation thread starts: creates the emulator's beeper and sets the initial controls
+bool emulator_user_interface_initialize(struct UserInterface *user_interface, struct EmulationThread *thread);
+
+// Handles events (passing them to the emulation thread) and draws its newest frame right away; the caller
+// paces the calls (see scheduler.h)
+void emulator_user_interface_update(struct UserInterface *user_interface, struct EmulationThread *thread);
+
+// Handles events as they arrive until about deadline_ns, so key presses reach the emulation thread without
+// waiting for the next draw
+void emulator_user_interface_wait_events(struct UserInterface *user_interface, struct EmulationThread *thread, uint64_t deadline_ns);
+
+// True while the front-end sleeps instead of running frames (paused, minimized or unfocused, as configured)
+bool emulator_user_interface_is_idle(const struct UserInterface *user_interface);
\ No newline at end of file
@@ -0,0 +1,20 @@
+// Lockstep verification: runs the emulator as configured (JIT or interpreter, superinstructions, idle loop
+// skipping) next to a reference copy that executes one instruction at a time with
+// emulator_emulate_instruction_reference(), and compares the two machines every interval instructions (0 = once per
+// frame). The emulator runs each budget as its engine does; the reference steps as many instructions as it
+// retired. A divergence is narrowed down by replaying from the last agreement with smaller budgets.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "emulator.h"
+
+#define VERIFY_LISTED_INSTRUCTIONS 16 // of the run that diverged, the last ones are listed in the report
+
+// Runs until the ROM quits, max_frames (0 = unlimited) are emulated or the machines differ. The first divergence
+// is reported on output: the instructions the reference ran since the machines last agreed, and both states.
+// Returns true when no divergence was found.
+bool emulator_verify_run(struct Emulator *emulator, uint64_t max_frames, uint64_t interval, FILE *output);
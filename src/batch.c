@@ -0,0 +1,280 @@
+// Batch runner: runs many ROMs headless on a pool of worker threads and reports one result per ROM
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // sysconf()
+
+#include "emulator.h"
+#include "headless.h"
+
+struct BatchOptions {
+    uint64_t max_frames;
+    uint64_t max_instructions;
+    uint32_t instructions_per_second; // 0 keeps the emulator default
+    uint64_t seed;
+    bool jit;
+    uint32_t extension; // CHIP8, SUPERCHIP or XOCHIP
+    bool run_idle_loops; // disables idle loop skipping
+    bool json;
+    uint32_t threads; // 0 = one per core
+    const char *output; // NULL = stdout
+};
+
+struct BatchJob {
+    const char *rom_name;
+
+    // results
+    bool loaded;
+    bool quit; // the ROM stopped by itself before the budget was used
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t wall_time_ns;
+    uint64_t display_hash;
+    uint16_t PC;
+    uint16_t I;
+    uint8_t V[16];
+};
+
+struct Batch {
+    const struct BatchOptions *options;
+    struct BatchJob *jobs;
+    size_t job_count;
+    atomic_size_t next_job;
+};
+
+static void batch_run_job(const struct BatchOptions *options, struct BatchJob *job) {
+    // Large (decoded instruction cache), so never on a worker stack
+    struct Emulator *emulator = malloc(sizeof(struct Emulator));
+    if (!emulator) return;
+
+    emulator_initialize(emulator);
+    emulated_seed_random(&emulator->emulated_system, options->seed);
+    if (options->instructions_per_second != 0) emulator->instructions_per_second = options->instructions_per_second;
+    if (options->jit) emulator->cpu = CPU_JIT;
+    emulator->extension = options->extension;
+    emulator->skip_idle_loops = !options->run_idle_loops;
+
+    job->loaded = emulator_load_rom(emulator, job->rom_name);
+    if (job->loaded) {
+        job->wall_time_ns = emulator_headless_run_frames(emulator, options->max_frames, options->max_instructions);
+        job->quit = emulator->emulated_system.state == QUIT;
+        job->frames = emulator->frames_executed;
+        job->instructions = emulator->instructions_executed;
+        job->display_hash = emulated_display_hash(&emulator->emulated_system);
+        job->PC = emulator->emulated_system.PC;
+        job->I = emulator->emulated_system.I;
+        memcpy(job->V, emulator->emulated_system.V, sizeof job->V);
+    }
+
+    emulator_destroy(emulator);
+    free(emulator);
+}
+
+static void *batch_worker(void *argument) {
+    struct Batch *batch = argument;
+
+    for (;;) {
+        const size_t index = atomic_fetch_add(&batch->next_job, 1);
+        if (index >= batch->job_count) return NULL;
+        batch_run_job(batch->options, &batch->jobs[index]);
+    }
+}
+
+static const char *batch_job_status(const struct BatchJob *job) {
+    if (!job->loaded) return "load_error";
+    return job->quit ? "quit" : "ok";
+}
+
+// Writes s between double quotes: CSV doubles the quotes inside, JSON escapes quotes, backslashes and control characters
+static void batch_write_quoted(FILE *file, const char *s, bool json) {
+    fputc('"', file);
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"') fputs(json ? "\\\"" : "\"\"", file);
+        else if (json && c == '\\') fputs("\\\\", file);
+        else if (json && c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+static void batch_write_csv(FILE *file, const struct BatchJob *jobs, size_t job_count) {
+    fprintf(file, "rom,status,frames,instructions,wall_time_ns,display_hash,pc,i");
+    for (int i = 0; i < 16; i++) fprintf(file, ",v%x", i);
+    fprintf(file, "\n");
+
+    for (size_t j = 0; j < job_count; j++) {
+        const struct BatchJob *job = &jobs[j];
+        batch_write_quoted(file, job->rom_name, false);
+        fprintf(file, ",%s,%llu,%llu,%llu,%016llx,%03x,%03x", batch_job_status(job),
+                (long long unsigned)job->frames, (long long unsigned)job->instructions,
+                (long long unsigned)job->wall_time_ns, (long long unsigned)job->display_hash, job->PC, job->I);
+        for (int i = 0; i < 16; i++) fprintf(file, ",%u", job->V[i]);
+        fprintf(file, "\n");
+    }
+}
+
+static void batch_write_json(FILE *file, const struct BatchJob *jobs, size_t job_count) {
+    fprintf(file, "[\n");
+    for (size_t j = 0; j < job_count; j++) {
+        const struct BatchJob *job = &jobs[j];
+        fprintf(file, "  {\"rom\": ");
+        batch_write_quoted(file, job->rom_name, true);
+        fprintf(file, ", \"status\": \"%s\", \"frames\": %llu, \"instructions\": %llu, "
+                      "\"wall_time_ns\": %llu, \"display_hash\": \"%016llx\", \"pc\": %u, \"i\": %u, \"v\": [",
+                batch_job_status(job), (long long unsigned)job->frames,
+                (long long unsigned)job->instructions, (long long unsigned)job->wall_time_ns,
+                (long long unsigned)job->display_hash, job->PC, job->I);
+        for (int i = 0; i < 16; i++) fprintf(file, "%s%u", i ? ", " : "", job->V[i]);
+        fprintf(file, "]}%s\n", j + 1 < job_count ? "," : "");
+    }
+    fprintf(file, "]\n");
+}
+
+// Appends a copy of rom_name to the list (freed by batch_free_roms()); false when out of memory
+static bool batch_add_rom(char ***rom_names, size_t *count, size_t *capacity, const char *rom_name) {
+    if (*count == *capacity) {
+        const size_t grown = *capacity ? *capacity * 2 : 64;
+        char **names = realloc(*rom_names, grown * sizeof *names);
+        if (!names) return false;
+        *rom_names = names;
+        *capacity = grown;
+    }
+
+    char *copy = strdup(rom_name);
+    if (!copy) return false;
+    (*rom_names)[(*count)++] = copy;
+    return true;
+}
+
+static void batch_free_roms(char **rom_names, size_t count) {
+    for (size_t j = 0; j < count; j++) free(rom_names[j]);
+    free(rom_names);
+}
+
+// Adds the ROM paths listed in a file (one per line) to the job list
+static bool batch_read_list(const char *list_name, char ***rom_names, size_t *count, size_t *capacity) {
+    FILE *list = fopen(list_name, "r");
+    if (!list) {
+        fprintf(stderr, "Could not open ROM list %s\n", list_name);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof line, list)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        if (!batch_add_rom(rom_names, count, capacity, line)) {
+            fprintf(stderr, "Out of memory reading ROM list %s\n", list_name);
+            fclose(list);
+            return false;
+        }
+    }
+    fclose(list);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    struct BatchOptions options = { .max_frames = 600 };
+    char **rom_names = NULL;
+    size_t rom_count = 0, rom_capacity = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu=jit") == 0) options.jit = true;
+        else if (strcmp(argv[i], "--cpu=interp") == 0) options.jit = false;
+        else if (strcmp(argv[i], "--extension=superchip") == 0) options.extension = SUPERCHIP;
+        else if (strcmp(argv[i], "--extension=xochip") == 0) options.extension = XOCHIP;
+        else if (strcmp(argv[i], "--extension=chip8") == 0) options.extension = CHIP8;
+        else if (strcmp(argv[i], "--no-idle-skip") == 0) options.run_idle_loops = true;
+        else if (strcmp(argv[i], "--json") == 0) options.json = true;
+        else if (strcmp(argv[i], "--csv") == 0) options.json = false;
+        else if (argv[i][0] == '-' && i + 1 >= argc) {
+            fprintf(stderr, "Incomplete argument %s\n", argv[i]);
+            batch_free_roms(rom_names, rom_count);
+            return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[i], "--frames") == 0) options.max_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--instructions") == 0) options.max_instructions = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ips") == 0) options.instructions_per_second = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0) options.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--threads") == 0) options.threads = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--output") == 0) options.output = argv[++i];
+        else if (strcmp(argv[i], "--list") == 0) {
+            if (!batch_read_list(argv[++i], &rom_names, &rom_count, &rom_capacity)) {
+                batch_free_roms(rom_names, rom_count);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            batch_free_roms(rom_names, rom_count);
+            return EXIT_FAILURE;
+        }
+        else if (!batch_add_rom(&rom_names, &rom_count, &rom_capacity, argv[i])) {
+            fprintf(stderr, "Out of memory\n");
+            batch_free_roms(rom_names, rom_count);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (rom_count == 0) {
+        fprintf(stderr, "Usage: %s [--frames N] [--instructions N] [--ips N] [--seed N] [--threads N] "
+                        "[--cpu=jit|interp] [--extension=chip8|superchip|xochip] [--no-idle-skip] [--csv|--json] [--output FILE] [--list FILE] [rom...]\n", argv[0]);
+        batch_free_roms(rom_names, rom_count);
+        return EXIT_FAILURE;
+    }
+
+    struct Batch batch = {
+        .options = &options,
+        .jobs = calloc(rom_count, sizeof(struct BatchJob)),
+        .job_count = rom_count,
+    };
+    if (!batch.jobs) {
+        fprintf(stderr, "Out of memory\n");
+        batch_free_roms(rom_names, rom_count);
+        return EXIT_FAILURE;
+    }
+    atomic_init(&batch.next_job, 0);
+    for (size_t j = 0; j < rom_count; j++) batch.jobs[j].rom_name = rom_names[j];
+
+    // Worker pool sized to the cores; every worker owns its emulator instance
+    uint32_t thread_count = options.threads;
+    if (thread_count == 0) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = cores > 0 ? (uint32_t)cores : 1;
+    }
+    if (thread_count > rom_count) thread_count = (uint32_t)rom_count;
+
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    uint32_t started = 0;
+    for (; threads && started < thread_count; started++)
+        if (pthread_create(&threads[started], NULL, batch_worker, &batch) != 0) break;
+
+    if (started == 0) batch_worker(&batch); // no threads available, run inline
+    for (uint32_t t = 0; t < started; t++) pthread_join(threads[t], NULL);
+
+    FILE *output = options.output ? fopen(options.output, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "Could not open %s\n", options.output);
+        free(threads);
+        free(batch.jobs);
+        batch_free_roms(rom_names, rom_count);
+        return EXIT_FAILURE;
+    }
+    if (options.json) batch_write_json(output, batch.jobs, batch.job_count);
+    else batch_write_csv(output, batch.jobs, batch.job_count);
+    if (output != stdout) fclose(output);
+
+    bool all_loaded = true;
+    for (size_t j = 0; j < rom_count; j++) all_loaded &= batch.jobs[j].loaded;
+
+    free(threads);
+    free(batch.jobs);
+    batch_free_roms(rom_names, rom_count);
+    return all_loaded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
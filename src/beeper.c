@@ -0,0 +1,256 @@
+// Beeper
+//
+// The emulation thread pushes one (frame number, sound on) entry per emulated frame into a ring; the audio
+// callback plays each entry for 1/60 s of samples. Before it starts, and again after an underrun or a gap in
+// the frame numbers, the consumer waits until `prefill` frames are queued, so the device buffer never drains
+// halfway through a frame. When more than `max_queued` frames pile up (the emulation runs slightly faster than
+// the audio clock) the oldest are dropped, which bounds the latency.
+//
+// The square wave is band-limited with PolyBLEP (no aliasing at any sample rate), and starts and stops are
+// ramped over a couple of milliseconds instead of jumping, so there are no clicks. XO-CHIP audio patterns
+// replace the square wave: each output sample is the average of the pattern bits it spans (a box filter).
+
+#include "beeper.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BEEPER_RING_FRAMES 64 // power of two, about one second
+#define BEEPER_FRAME_RATE 60
+#define BEEPER_RAMP_PER_SECOND 500 // envelope ramps last 2 ms
+#define BEEPER_PATTERN_BITS (AUDIO_PATTERN_SIZE * 8)
+
+struct BeeperFrame {
+    uint64_t frame;
+    bool on;
+    bool has_pattern;
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+struct Beeper {
+    struct BeeperFrame frames[BEEPER_RING_FRAMES];
+    _Atomic uint64_t head; // written by the producer
+    _Atomic uint64_t tail; // written by the consumer
+    _Atomic int32_t volume;
+    _Atomic bool muted;
+    _Atomic uint64_t underruns;
+    _Atomic uint64_t dropped;
+
+    // consumer only
+    uint32_t sample_rate;
+    uint32_t prefill; // frames queued before playback starts
+    uint32_t max_queued; // frames queued before the oldest are dropped
+    uint64_t frame; // number of the frame being played
+    bool on; // its sound state
+    bool has_pattern; // and its XO-CHIP audio pattern
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    float pattern_step; // pattern bits per sample, for pitch
+    float pattern_position; // 0 to BEEPER_PATTERN_BITS
+    bool starved;
+    uint32_t frame_samples_left;
+    uint32_t sample_remainder; // fraction of a sample carried between frames, in 1/60ths
+    float phase; // 0 to 1
+    float phase_step; // tone frequency / sample rate
+    float ramp_step; // envelope change per sample
+    float envelope; // 0 (silent) to 1
+    float gain; // follows volume smoothly
+};
+
+struct Beeper *emulator_beeper_create(uint32_t sample_rate, uint32_t tone_frequency, int16_t volume, uint32_t buffer_samples) {
+    if (sample_rate == 0 || tone_frequency == 0) return NULL;
+
+    struct Beeper *beeper = calloc(1, sizeof(struct Beeper));
+    if (!beeper) return NULL;
+
+    atomic_init(&beeper->head, 0);
+    atomic_init(&beeper->tail, 0);
+    atomic_init(&beeper->volume, volume);
+    atomic_init(&beeper->muted, false);
+    atomic_init(&beeper->underruns, 0);
+    atomic_init(&beeper->dropped, 0);
+
+    // One device buffer worth of frames plus two of margin for the producer's jitter
+    beeper->prefill = 2 + (uint32_t)((uint64_t)buffer_samples * BEEPER_FRAME_RATE / sample_rate);
+    if (beeper->prefill > BEEPER_RING_FRAMES / 2) beeper->prefill = BEEPER_RING_FRAMES / 2;
+    beeper->max_queued = beeper->prefill + 2;
+
+    beeper->sample_rate = sample_rate;
+    beeper->starved = true;
+    beeper->phase_step = (float)tone_frequency / sample_rate;
+    beeper->ramp_step = (float)BEEPER_RAMP_PER_SECOND / sample_rate;
+    beeper->gain = volume;
+    beeper->pitch = AUDIO_DEFAULT_PITCH;
+    beeper->pattern_step = 4000.0f / sample_rate;
+    return beeper;
+}
+
+void emulator_beeper_destroy(struct Beeper *beeper) {
+    free(beeper);
+}
+
+void emulator_beeper_push(struct Beeper *beeper, uint64_t frame, bool on, const uint8_t *pattern, uint8_t pitch) {
+    const uint64_t head = atomic_load_explicit(&beeper->head, memory_order_relaxed);
+    const uint64_t tail = atomic_load_explicit(&beeper->tail, memory_order_acquire);
+
+    // Full: the callback is not running (or is far behind), this frame is lost either way
+    if (head - tail >= BEEPER_RING_FRAMES) {
+        atomic_fetch_add_explicit(&beeper->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct BeeperFrame *entry = &beeper->frames[head & (BEEPER_RING_FRAMES - 1)];
+    *entry = (struct BeeperFrame){ .frame = frame, .on = on, .has_pattern = pattern != NULL, .pitch = pitch };
+    if (pattern) memcpy(entry->pattern, pattern, AUDIO_PATTERN_SIZE);
+    atomic_store_explicit(&beeper->head, head + 1, memory_order_release);
+}
+
+void emulator_beeper_set_volume(struct Beeper *beeper, int16_t volume) {
+    atomic_store_explicit(&beeper->volume, volume, memory_order_relaxed);
+}
+
+void emulator_beeper_set_muted(struct Beeper *beeper, bool muted) {
+    atomic_store_explicit(&beeper->muted, muted, memory_order_relaxed);
+}
+
+uint64_t emulator_beeper_underruns(const struct Beeper *beeper) {
+    return atomic_load_explicit(&beeper->underruns, memory_order_relaxed);
+}
+
+uint64_t emulator_beeper_dropped(const struct Beeper *beeper) {
+    return atomic_load_explicit(&beeper->dropped, memory_order_relaxed);
+}
+
+// 4000 * 2 ^ ((pitch - 64) / 48) pattern bits per second
+static float emulator_beeper_pattern_rate(uint8_t pitch) {
+    float rate = 4000.0f;
+    for (int i = pitch; i > AUDIO_DEFAULT_PITCH; i--) rate *= 1.0145453349f; // 2 ^ (1 / 48)
+    for (int i = pitch; i < AUDIO_DEFAULT_PITCH; i++) rate /= 1.0145453349f;
+    return rate;
+}
+
+// Average of the pattern (bits as +1/-1) over [position, position + width), in bits
+static float emulator_beeper_pattern_level(const uint8_t *pattern, float position, float width) {
+    const float end = position + width;
+    float level = 0.0f;
+
+    for (uint32_t bit = (uint32_t)position; position < end; bit++) {
+        const float stop = bit + 1 < end ? bit + 1 : end;
+        const uint32_t index = bit % BEEPER_PATTERN_BITS;
+        level += (stop - position) * ((pattern[index / 8] >> (7 - index % 8)) & 1 ? 1.0f : -1.0f);
+        position = stop;
+    }
+    return level / width;
+}
+
+// Starts playing the next queued frame; false when there is none to play yet
+static bool emulator_beeper_next_frame(struct Beeper *beeper) {
+    const uint64_t head = atomic_load_explicit(&beeper->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&beeper->tail, memory_order_relaxed);
+
+    if (atomic_load_explicit(&beeper->muted, memory_order_relaxed)) {
+        if (tail != head) atomic_store_explicit(&beeper->tail, head, memory_order_release);
+        beeper->starved = true; // start with a full queue once unmuted
+        return false;
+    }
+
+    const uint64_t queued = head - tail;
+    if (queued == 0) {
+        if (!beeper->starved) atomic_fetch_add_explicit(&beeper->underruns, 1, memory_order_relaxed);
+        beeper->starved = true;
+        return false;
+    }
+
+    const bool gap = beeper->frames[tail & (BEEPER_RING_FRAMES - 1)].frame != beeper->frame + 1;
+    if ((beeper->starved || gap) && queued < beeper->prefill) {
+        beeper->starved = true;
+        return false;
+    }
+    beeper->starved = false;
+
+    if (queued > beeper->max_queued) {
+        const uint64_t late = queued - beeper->prefill;
+        atomic_fetch_add_explicit(&beeper->dropped, late, memory_order_relaxed);
+        tail += late;
+    }
+
+    const struct BeeperFrame frame = beeper->frames[tail & (BEEPER_RING_FRAMES - 1)];
+    atomic_store_explicit(&beeper->tail, tail + 1, memory_order_release);
+    beeper->frame = frame.frame;
+    beeper->on = frame.on;
+    beeper->has_pattern = frame.has_pattern;
+    if (frame.has_pattern) {
+        memcpy(beeper->pattern, frame.pattern, AUDIO_PATTERN_SIZE);
+        if (frame.pitch != beeper->pitch) {
+            beeper->pitch = frame.pitch;
+            beeper->pattern_step = emulator_beeper_pattern_rate(frame.pitch) / beeper->sample_rate;
+        }
+    }
+
+    // sample_rate / 60 samples, the remainder carried over so that 60 frames last exactly one second
+    beeper->sample_remainder += beeper->sample_rate;
+    beeper->frame_samples_left = beeper->sample_remainder / BEEPER_FRAME_RATE;
+    beeper->sample_remainder -= beeper->frame_samples_left * BEEPER_FRAME_RATE;
+    return beeper->frame_samples_left > 0;
+}
+
+// Correction for the discontinuity of a step at distance t (in phase) from the current sample
+static inline float emulator_beeper_polyblep(float t, float dt) {
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0f;
+    }
+    if (t > 1.0f - dt) {
+        t = (t - 1.0f) / dt;
+        return t * t + t + t + 1.0f;
+    }
+    return 0.0f;
+}
+
+void emulator_beeper_render(struct Beeper *beeper, int16_t *samples, size_t count) {
+    const float volume = (float)atomic_load_explicit(&beeper->volume, memory_order_relaxed);
+    const float dt = beeper->phase_step;
+    const float step = beeper->ramp_step;
+
+    for (size_t i = 0; i < count; i++) {
+        if (beeper->frame_samples_left == 0 && !emulator_beeper_next_frame(beeper)) beeper->on = false;
+        else beeper->frame_samples_left--;
+
+        // Linear ramps in and out; volume changes glide too
+        if (beeper->on) beeper->envelope = beeper->envelope + step < 1.0f ? beeper->envelope + step : 1.0f;
+        else beeper->envelope = beeper->envelope - step > 0.0f ? beeper->envelope - step : 0.0f;
+        beeper->gain += (volume - beeper->gain) * step;
+
+        if (beeper->envelope == 0.0f) {
+            beeper->phase = 0.0f; // every beep starts at the same point of the wave
+            beeper->pattern_position = 0.0f;
+            samples[i] = 0;
+            continue;
+        }
+
+        float wave;
+        if (beeper->has_pattern) {
+            wave = emulator_beeper_pattern_level(beeper->pattern, beeper->pattern_position, beeper->pattern_step);
+            beeper->pattern_position += beeper->pattern_step;
+            while (beeper->pattern_position >= BEEPER_PATTERN_BITS) beeper->pattern_position -= BEEPER_PATTERN_BITS;
+        }
+        else {
+            // Naive square plus the corrections for its rising (phase 0) and falling (phase 0.5) edges
+            float half = beeper->phase + 0.5f;
+            if (half >= 1.0f) half -= 1.0f;
+            wave = beeper->phase < 0.5f ? 1.0f : -1.0f;
+            wave += emulator_beeper_polyblep(beeper->phase, dt);
+            wave -= emulator_beeper_polyblep(half, dt);
+
+            beeper->phase += dt;
+            if (beeper->phase >= 1.0f) beeper->phase -= 1.0f;
+        }
+
+        float sample = wave * beeper->envelope * beeper->gain;
+        if (sample > INT16_MAX) sample = INT16_MAX;
+        if (sample < INT16_MIN) sample = INT16_MIN;
+        samples[i] = (int16_t)sample;
+    }
+}
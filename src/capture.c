@@ -0,0 +1,379 @@
+// Video capture writer
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+enum CaptureFormat {
+    CAPTURE_RAW,
+    CAPTURE_Y4M,
+    CAPTURE_PNG,
+};
+
+struct CaptureFrame {
+    uint64_t display[DISPLAY_PLANES][DISPLAY_HEIGHT][DISPLAY_WORDS];
+    bool hires;
+};
+
+struct Capture {
+    enum CaptureFormat format;
+    uint32_t width, height; // canvas, before scaling
+    uint32_t scale;
+    uint32_t palette[4];
+    uint8_t ycbcr[4][3]; // Y4M: the palette in BT.601 limited range
+
+    // Queue of CAPTURE_QUEUE_FRAMES frames: the emulator writes at head, the writer reads at tail. Slots are
+    // copied outside the lock; lock guards head, tail and stop, and each side sleeps on its condition variable
+    // while it has nothing to do (writer: queue empty, emulator: queue full).
+    struct CaptureFrame *queue;
+    pthread_mutex_t lock;
+    pthread_cond_t queued; // signaled when head moves or stop is set
+    pthread_cond_t freed; // signaled when tail moves
+    uint64_t head;
+    uint64_t tail;
+    bool stop;
+    uint64_t stalls; // times the emulator waited for the writer
+
+    // Writer thread only
+    uint8_t *indices; // palette index of every output pixel
+    uint8_t *encoded; // the last frame in the output format, reused while the display does not change
+    size_t encoded_size;
+    struct CaptureFrame last;
+    bool has_last;
+    uint64_t frames_written;
+    bool failed;
+    FILE *file; // Y4M and raw
+    char *filename; // PNG: the name, numbered per frame
+    size_t stem_length; // PNG: where the number goes
+    pthread_t writer;
+};
+
+static uint32_t capture_output_width(const struct Capture *capture) {
+    return capture->width * capture->scale;
+}
+
+static uint32_t capture_output_height(const struct Capture *capture) {
+    return capture->height * capture->scale;
+}
+
+// Palette index of every output pixel; the display is sampled at the canvas resolution, then scaled
+static void capture_render(struct Capture *capture, const struct CaptureFrame *frame) {
+    const uint32_t display_width = frame->hires ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+    const uint32_t display_height = frame->hires ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+    const uint32_t output_width = capture_output_width(capture);
+    const uint32_t scale = capture->scale;
+
+    for (uint32_t y = 0; y < capture->height; y++) {
+        const uint32_t display_y = y * display_height / capture->height;
+        uint8_t *row = &capture->indices[(size_t)y * scale * output_width];
+
+        for (uint32_t x = 0; x < capture->width; x++) {
+            const uint32_t display_x = x * display_width / capture->width;
+            const uint32_t shift = 63 - display_x % 64;
+            const uint8_t index = ((frame->display[0][display_y][display_x / 64] >> shift) & 1)
+                                  | ((frame->display[1][display_y][display_x / 64] >> shift) & 1) << 1;
+            memset(&row[x * scale], index, scale);
+        }
+        for (uint32_t copy = 1; copy < scale; copy++) memcpy(&row[copy * output_width], row, output_width);
+    }
+}
+
+static uint8_t *put32(uint8_t *cursor, uint32_t value) {
+    cursor[0] = value >> 24;
+    cursor[1] = value >> 16;
+    cursor[2] = value >> 8;
+    cursor[3] = value;
+    return cursor + 4;
+}
+
+// Chunk length, type and data are in place at chunk; appends the CRC over type and data
+static uint8_t *capture_png_end_chunk(uint8_t *chunk, uint32_t length) {
+    return put32(chunk + 8 + length, emulated_crc32(chunk + 4, 4 + length));
+}
+
+#define PNG_STORED_BLOCK 65535
+
+// Size of a PNG of the output size: RGB rows with a filter byte each, in stored deflate blocks
+static size_t capture_png_size(const struct Capture *capture) {
+    const size_t raw = (size_t)capture_output_height(capture) * (1 + 3 * (size_t)capture_output_width(capture));
+    const size_t blocks = (raw + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK;
+    const size_t idat = 2 + raw + 5 * blocks + 4; // zlib header, data, block headers, Adler-32
+    return 8 + (12 + 13) + (12 + idat) + 12;
+}
+
+static void capture_encode_png(struct Capture *capture) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    const uint32_t width = capture_output_width(capture), height = capture_output_height(capture);
+    const size_t raw = (size_t)height * (1 + 3 * (size_t)width);
+    const size_t blocks = (raw + PNG_STORED_BLOCK - 1) / PNG_STORED_BLOCK;
+    uint8_t *cursor = capture->encoded;
+
+    memcpy(cursor, signature, sizeof signature);
+    cursor += sizeof signature;
+
+    uint8_t *chunk = cursor;
+    cursor = put32(cursor, 13);
+    memcpy(cursor, "IHDR", 4);
+    cursor = put32(put32(cursor + 4, width), height);
+    *cursor++ = 8; // bits per channel
+    *cursor++ = 2; // RGB
+    *cursor++ = 0; // deflate
+    *cursor++ = 0; // adaptive filtering (every row uses filter 0)
+    *cursor++ = 0; // not interlaced
+    cursor = capture_png_end_chunk(chunk, 13);
+
+    const uint32_t idat_length = (uint32_t)(2 + raw + 5 * blocks + 4);
+    chunk = cursor;
+    cursor = put32(cursor, idat_length);
+    memcpy(cursor, "IDAT", 4);
+    cursor += 4;
+    *cursor++ = 0x78; // zlib: deflate, 32 KB window
+    *cursor++ = 0x01; // no preset dictionary, fastest (header checksum: 0x7801 % 31 == 0)
+
+    // The rows go through stored blocks as one stream; Adler-32 is computed along
+    uint32_t adler_a = 1, adler_b = 0;
+    size_t block_left = 0, written = 0;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *indices = &capture->indices[(size_t)y * width];
+        for (uint32_t byte = 0; byte < 1 + 3 * width; byte++) {
+            if (block_left == 0) {
+                const size_t length = raw - written < PNG_STORED_BLOCK ? raw - written : PNG_STORED_BLOCK;
+                *cursor++ = written + length == raw; // BFINAL, BTYPE 00 (stored)
+                *cursor++ = length & 0xFF;
+                *cursor++ = length >> 8;
+                *cursor++ = ~length & 0xFF;
+                *cursor++ = (~length >> 8) & 0xFF;
+                block_left = length;
+            }
+
+            uint8_t value = 0; // filter type 0 starts the row
+            if (byte > 0) {
+                const uint32_t color = capture->palette[indices[(byte - 1) / 3]];
+                value = color >> (24 - 8 * ((byte - 1) % 3));
+            }
+            *cursor++ = value;
+            adler_a = (adler_a + value) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+            block_left--;
+            written++;
+        }
+    }
+    cursor = put32(cursor, adler_b << 16 | adler_a);
+    cursor = capture_png_end_chunk(chunk, idat_length);
+
+    chunk = cursor;
+    cursor = put32(cursor, 0);
+    memcpy(cursor, "IEND", 4);
+    cursor = capture_png_end_chunk(chunk, 0);
+
+    capture->encoded_size = cursor - capture->encoded;
+}
+
+static void capture_encode(struct Capture *capture) {
+    const size_t pixels = (size_t)capture_output_width(capture) * capture_output_height(capture);
+    uint8_t *cursor = capture->encoded;
+
+    switch (capture->format) {
+        case CAPTURE_RAW:
+            for (size_t i = 0; i < pixels; i++) cursor = put32(cursor, capture->palette[capture->indices[i]]);
+            capture->encoded_size = cursor - capture->encoded;
+            break;
+
+        case CAPTURE_Y4M:
+            memcpy(cursor, "FRAME\n", 6);
+            cursor += 6;
+            for (int plane = 0; plane < 3; plane++)
+                for (size_t i = 0; i < pixels; i++) *cursor++ = capture->ycbcr[capture->indices[i]][plane];
+            capture->encoded_size = cursor - capture->encoded;
+            break;
+
+        case CAPTURE_PNG:
+            capture_encode_png(capture);
+            break;
+    }
+}
+
+static void capture_write(struct Capture *capture) {
+    FILE *file = capture->file;
+
+    if (capture->format == CAPTURE_PNG) {
+        // out.png: out-000000.png, out-000001.png, ...
+        char name[4096];
+        snprintf(name, sizeof name, "%.*s-%06llu%s", (int)capture->stem_length, capture->filename,
+                 (long long unsigned)capture->frames_written, capture->filename + capture->stem_length);
+        file = fopen(name, "wb");
+        if (!file) {
+            if (!capture->failed) fprintf(stderr, "capture: could not create %s\n", name);
+            capture->failed = true;
+            return;
+        }
+    }
+
+    if (fwrite(capture->encoded, capture->encoded_size, 1, file) != 1) capture->failed = true;
+    if (capture->format == CAPTURE_PNG && fclose(file) != 0) capture->failed = true;
+    capture->frames_written++;
+}
+
+// Writer thread: renders, encodes and writes each queued frame. A frame that shows the same display as the one
+// before is written again from the same encoded bytes.
+static void *capture_writer(void *argument) {
+    struct Capture *capture = argument;
+
+    pthread_mutex_lock(&capture->lock);
+    for (;;) {
+        while (capture->head == capture->tail && !capture->stop) pthread_cond_wait(&capture->queued, &capture->lock);
+        if (capture->head == capture->tail) break; // stopping, everything was written
+
+        const struct CaptureFrame *frame = &capture->queue[capture->tail % CAPTURE_QUEUE_FRAMES];
+        pthread_mutex_unlock(&capture->lock);
+
+        const bool changed = !capture->has_last || frame->hires != capture->last.hires
+                             || memcmp(frame->display, capture->last.display, sizeof frame->display) != 0;
+        if (changed) {
+            capture->last = *frame;
+            capture->has_last = true;
+        }
+
+        // The slot is free once compared or copied
+        pthread_mutex_lock(&capture->lock);
+        capture->tail++;
+        pthread_cond_signal(&capture->freed);
+        pthread_mutex_unlock(&capture->lock);
+
+        if (changed) {
+            capture_render(capture, &capture->last);
+            capture_encode(capture);
+        }
+        capture_write(capture);
+        pthread_mutex_lock(&capture->lock);
+    }
+    pthread_mutex_unlock(&capture->lock);
+    return NULL;
+}
+
+// BT.601 limited range, in fixed-point
+static void capture_set_ycbcr(uint8_t ycbcr[3], uint32_t color) {
+    const int32_t r = (color >> 24) & 0xFF, g = (color >> 16) & 0xFF, b = (color >> 8) & 0xFF;
+
+    ycbcr[0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    ycbcr[1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    ycbcr[2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static bool capture_has_extension(const char *filename, const char *extension) {
+    const size_t length = strlen(filename), extension_length = strlen(extension);
+    return length >= extension_length && strcmp(filename + length - extension_length, extension) == 0;
+}
+
+struct Capture *emulator_capture_open(const char *filename, uint32_t width, uint32_t height, uint32_t scale, const uint32_t palette[4]) {
+    struct Capture *capture = calloc(1, sizeof(struct Capture));
+    if (!capture) return NULL;
+
+    capture->format = capture_has_extension(filename, ".y4m") ? CAPTURE_Y4M
+                    : capture_has_extension(filename, ".png") ? CAPTURE_PNG : CAPTURE_RAW;
+    capture->width = width;
+    capture->height = height;
+    capture->scale = scale;
+    for (int i = 0; i < 4; i++) {
+        capture->palette[i] = palette[i];
+        capture_set_ycbcr(capture->ycbcr[i], palette[i]);
+    }
+
+    const size_t pixels = (size_t)capture_output_width(capture) * capture_output_height(capture);
+    const size_t encoded_size = capture->format == CAPTURE_PNG ? capture_png_size(capture)
+                              : capture->format == CAPTURE_Y4M ? 6 + 3 * pixels : 4 * pixels;
+    capture->queue = malloc(CAPTURE_QUEUE_FRAMES * sizeof(struct CaptureFrame));
+    if (capture->queue) memset(capture->queue, 0, CAPTURE_QUEUE_FRAMES * sizeof(struct CaptureFrame)); // fault the pages in now
+    capture->indices = malloc(pixels);
+    capture->encoded = malloc(encoded_size);
+
+    bool ok = capture->queue && capture->indices && capture->encoded && scale > 0 && pixels > 0;
+    if (ok && capture->format == CAPTURE_PNG) {
+        capture->filename = strdup(filename);
+        capture->stem_length = strlen(filename) - strlen(".png");
+        ok = capture->filename != NULL;
+    }
+    else if (ok) {
+        capture->file = fopen(filename, "wb");
+        ok = capture->file != NULL;
+        if (ok && capture->format == CAPTURE_Y4M)
+            ok = fprintf(capture->file, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C444\n",
+                         capture_output_width(capture), capture_output_height(capture)) > 0;
+    }
+
+    bool synchronized = false;
+    if (ok) {
+        synchronized = pthread_mutex_init(&capture->lock, NULL) == 0;
+        if (synchronized && pthread_cond_init(&capture->queued, NULL) != 0) {
+            pthread_mutex_destroy(&capture->lock);
+            synchronized = false;
+        }
+        if (synchronized && pthread_cond_init(&capture->freed, NULL) != 0) {
+            pthread_cond_destroy(&capture->queued);
+            pthread_mutex_destroy(&capture->lock);
+            synchronized = false;
+        }
+    }
+
+    if (!synchronized || pthread_create(&capture->writer, NULL, capture_writer, capture) != 0) {
+        fprintf(stderr, "Could not start capturing to %s\n", filename);
+        if (synchronized) {
+            pthread_cond_destroy(&capture->freed);
+            pthread_cond_destroy(&capture->queued);
+            pthread_mutex_destroy(&capture->lock);
+        }
+        if (capture->file) fclose(capture->file);
+        free(capture->filename);
+        free(capture->encoded);
+        free(capture->indices);
+        free(capture->queue);
+        free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+void emulator_capture_frame(struct Capture *capture, const struct EmulatedSystem *emulated_system) {
+    pthread_mutex_lock(&capture->lock);
+    if (capture->head - capture->tail >= CAPTURE_QUEUE_FRAMES) {
+        // Full: frames are never dropped, the emulator sleeps until the writer frees a slot
+        capture->stalls++;
+        while (capture->head - capture->tail >= CAPTURE_QUEUE_FRAMES) pthread_cond_wait(&capture->freed, &capture->lock);
+    }
+    struct CaptureFrame *frame = &capture->queue[capture->head % CAPTURE_QUEUE_FRAMES];
+    pthread_mutex_unlock(&capture->lock);
+
+    memcpy(frame->display, emulated_system->display, sizeof frame->display);
+    frame->hires = emulated_system->hires;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head++;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+bool emulator_capture_close(struct Capture *capture) {
+    if (!capture) return true;
+
+    pthread_mutex_lock(&capture->lock);
+    capture->stop = true;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->writer, NULL);
+    pthread_cond_destroy(&capture->freed);
+    pthread_cond_destroy(&capture->queued);
+    pthread_mutex_destroy(&capture->lock);
+
+    bool ok = !capture->failed;
+    if (capture->file) ok &= fclose(capture->file) == 0;
+    if (capture->stalls) fprintf(stderr, "capture: the emulator waited for the writer %llu times\n", (long long unsigned)capture->stalls);
+    free(capture->filename);
+    free(capture->encoded);
+    free(capture->indices);
+    free(capture->queue);
+    free(capture);
+    return ok;
+}
@@ -0,0 +1,117 @@
+// Disassembler
+
+#include "disassembler.h"
+
+#include <stdio.h>
+
+enum OperandLayout {
+    OPERANDS_NONE,
+    OPERANDS_N,
+    OPERANDS_NNN,
+    OPERANDS_X,
+    OPERANDS_XNN,
+    OPERANDS_XY,
+    OPERANDS_XYN,
+};
+
+struct OpcodeForm {
+    uint16_t mask;
+    uint16_t pattern;
+    const char *name;
+    const char *format;
+    enum OperandLayout operands;
+};
+
+// Searched in order, so specific forms come before the ones they overlap (00E0 before 0NNN)
+// SUPER-CHIP and XO-CHIP forms are listed too; the emulator only runs them when the extension is enabled
+static const struct OpcodeForm opcode_forms[OPCODE_CLASS_COUNT - 1] = {
+    { 0xFFFF, 0x00E0, "00E0", "CLS", OPERANDS_NONE },
+    { 0xFFFF, 0x00EE, "00EE", "RET", OPERANDS_NONE },
+    { 0xFFF0, 0x00C0, "00CN", "SCD %u", OPERANDS_N },
+    { 0xFFF0, 0x00D0, "00DN", "SCU %u", OPERANDS_N },
+    { 0xFFFF, 0x00FB, "00FB", "SCR", OPERANDS_NONE },
+    { 0xFFFF, 0x00FC, "00FC", "SCL", OPERANDS_NONE },
+    { 0xFFFF, 0x00FD, "00FD", "EXIT", OPERANDS_NONE },
+    { 0xFFFF, 0x00FE, "00FE", "LOW", OPERANDS_NONE },
+    { 0xFFFF, 0x00FF, "00FF", "HIGH", OPERANDS_NONE },
+    { 0xF000, 0x0000, "0NNN", "SYS 0x%03X", OPERANDS_NNN },
+    { 0xF000, 0x1000, "1NNN", "JP 0x%03X", OPERANDS_NNN },
+    { 0xF000, 0x2000, "2NNN", "CALL 0x%03X", OPERANDS_NNN },
+    { 0xF000, 0x3000, "3XNN", "SE V%X, 0x%02X", OPERANDS_XNN },
+    { 0xF000, 0x4000, "4XNN", "SNE V%X, 0x%02X", OPERANDS_XNN },
+    { 0xF00F, 0x5000, "5XY0", "SE V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x5002, "5XY2", "LD [I], V%X-V%X", OPERANDS_XY },
+    { 0xF00F, 0x5003, "5XY3", "LD V%X-V%X, [I]", OPERANDS_XY },
+    { 0xF000, 0x6000, "6XNN", "LD V%X, 0x%02X", OPERANDS_XNN },
+    { 0xF000, 0x7000, "7XNN", "ADD V%X, 0x%02X", OPERANDS_XNN },
+    { 0xF00F, 0x8000, "8XY0", "LD V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8001, "8XY1", "OR V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8002, "8XY2", "AND V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8003, "8XY3", "XOR V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8004, "8XY4", "ADD V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8005, "8XY5", "SUB V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8006, "8XY6", "SHR V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x8007, "8XY7", "SUBN V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x800E, "8XYE", "SHL V%X, V%X", OPERANDS_XY },
+    { 0xF00F, 0x9000, "9XY0", "SNE V%X, V%X", OPERANDS_XY },
+    { 0xF000, 0xA000, "ANNN", "LD I, 0x%03X", OPERANDS_NNN },
+    { 0xF000, 0xB000, "BNNN", "JP V0, 0x%03X", OPERANDS_NNN },
+    { 0xF000, 0xC000, "CXNN", "RND V%X, 0x%02X", OPERANDS_XNN },
+    { 0xF000, 0xD000, "DXYN", "DRW V%X, V%X, %u", OPERANDS_XYN },
+    { 0xF0FF, 0xE09E, "EX9E", "SKP V%X", OPERANDS_X },
+    { 0xF0FF, 0xE0A1, "EXA1", "SKNP V%X", OPERANDS_X },
+    { 0xFFFF, 0xF000, "F000", "LD I, LONG", OPERANDS_NONE },
+    { 0xF0FF, 0xF001, "FN01", "PLANE %X", OPERANDS_X },
+    { 0xFFFF, 0xF002, "F002", "AUDIO", OPERANDS_NONE },
+    { 0xF0FF, 0xF007, "FX07", "LD V%X, DT", OPERANDS_X },
+    { 0xF0FF, 0xF00A, "FX0A", "LD V%X, K", OPERANDS_X },
+    { 0xF0FF, 0xF015, "FX15", "LD DT, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF018, "FX18", "LD ST, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF01E, "FX1E", "ADD I, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF029, "FX29", "LD F, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF030, "FX30", "LD HF, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF033, "FX33", "LD B, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF03A, "FX3A", "PITCH V%X", OPERANDS_X },
+    { 0xF0FF, 0xF055, "FX55", "LD [I], V%X", OPERANDS_X },
+    { 0xF0FF, 0xF065, "FX65", "LD V%X, [I]", OPERANDS_X },
+    { 0xF0FF, 0xF075, "FX75", "LD R, V%X", OPERANDS_X },
+    { 0xF0FF, 0xF085, "FX85", "LD V%X, R", OPERANDS_X },
+};
+
+#define OPCODE_CLASS_INVALID (OPCODE_CLASS_COUNT - 1)
+
+// opcode_forms is sorted by first nibble: forms [first_form[n], first_form[n + 1]) start with nibble n
+static const uint8_t first_form[17] = { 0, 10, 11, 12, 13, 14, 17, 18, 19, 28, 29, 30, 31, 32, 33, 35, 51 };
+
+uint8_t emulator_opcode_class(uint16_t opcode) {
+    const uint8_t nibble = opcode >> 12;
+
+    for (uint8_t i = first_form[nibble]; i < first_form[nibble + 1]; i++)
+        if ((opcode & opcode_forms[i].mask) == opcode_forms[i].pattern) return i;
+    return OPCODE_CLASS_INVALID;
+}
+
+const char *emulator_opcode_class_name(uint8_t opcode_class) {
+    return opcode_class < OPCODE_CLASS_INVALID ? opcode_forms[opcode_class].name : "invalid";
+}
+
+void emulator_disassemble(uint16_t opcode, char *text, size_t size) {
+    const uint8_t opcode_class = emulator_opcode_class(opcode);
+    const unsigned X = (opcode >> 8) & 0x0F, Y = (opcode >> 4) & 0x0F;
+
+    if (opcode_class == OPCODE_CLASS_INVALID) {
+        snprintf(text, size, "DW 0x%04X", opcode);
+        return;
+    }
+
+    const struct OpcodeForm *form = &opcode_forms[opcode_class];
+    switch (form->operands) {
+        case OPERANDS_NONE: snprintf(text, size, "%s", form->format); break;
+        case OPERANDS_N: snprintf(text, size, form->format, opcode & 0x0Fu); break;
+        case OPERANDS_NNN: snprintf(text, size, form->format, opcode & 0x0FFFu); break;
+        case OPERANDS_X: snprintf(text, size, form->format, X); break;
+        case OPERANDS_XNN: snprintf(text, size, form->format, X, opcode & 0xFFu); break;
+        case OPERANDS_XY: snprintf(text, size, form->format, X, Y); break;
+        case OPERANDS_XYN: snprintf(text, size, form->format, X, Y, opcode & 0x0Fu); break;
+    }
+}
@@ -1,11 +1,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h> // open()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h> // close()
 
 #include "emulated.h"
 
 const uint32_t emulated_system_entry_point = 0x200; // CHIP8 Roms will be loaded to 0x200
-const uint8_t emulated_system_font[] = {
+const uint8_t emulated_system_font[16 * 5] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0,   // 0
     0x20, 0x60, 0x20, 0x20, 0x70,   // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0,   // 2
@@ -24,33 +30,329 @@ const uint8_t emulated_system_font[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80,   // F
 };
 
-bool emulated_save_state(struct EmulatedSystem *emulated_system, const char *filename) {
+// Right after the small font, still below the entry point
+const uint32_t emulated_system_large_font_address = sizeof emulated_system_font;
+const uint8_t emulated_system_large_font[16 * 10] = {
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+};
+
+void emulated_seed_random(struct EmulatedSystem *emulated_system, uint64_t seed) {
+    emulated_system->random_state = seed;
+}
+
+uint8_t emulated_random(struct EmulatedSystem *emulated_system) {
+    uint64_t z = (emulated_system->random_state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return (z ^ (z >> 31)) >> 56;
+}
+
+uint64_t emulated_display_hash(const struct EmulatedSystem *emulated_system) {
+    uint64_t hash = 0xCBF29CE484222325u;
+
+    for (size_t i = 0; i < sizeof emulated_system->display; i++) {
+        hash ^= ((const uint8_t *)emulated_system->display)[i];
+        hash *= 0x100000001B3u;
+    }
+    return hash;
+}
+
+static const uint32_t crc32_nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t emulated_crc32(const uint8_t *data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+        crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+/*
+ * Save state format, all integers little-endian:
+ *
+ *   header   "TC8S", u16 version, u16 reserved (0), u32 length of the chunks that follow
+ *   chunks   4-byte tag, u32 payload length, payload
+ *   trailer  u32 CRC-32 of everything before it
+ *
+ *   "ROM "  u32 CRC-32 of the ROM the state belongs to
+ *   "CPU "  V0-VF, u16 I, u16 PC, u8 delay timer, u8 sound timer, u8 awaited key, u8 stack depth,
+ *           u16 stack[STACK_SIZE], u64 random generator state
+ *   "RAM "  CHIP8_RAM_SIZE bytes, or RAM_SIZE for XO-CHIP (shorter chunks leave the rest of RAM zeroed)
+ *   "DISP"  u16 width, u16 height (64x32, or 128x64 in SUPER-CHIP hi-res), width / 64 u64 words per row
+ *           (bit 63 of the first word = leftmost pixel)
+ *   "RPL "  RPL_FLAGS bytes of SUPER-CHIP user flags (optional)
+ *   "DSP2"  second XO-CHIP plane, same layout as "DISP" (optional)
+ *   "XO  "  u8 selected planes, u8 pitch, u8 audio pattern loaded, AUDIO_PATTERN_SIZE bytes of pattern (optional)
+ *
+ * Readers skip chunks they do not know and ignore bytes appended to a known chunk, so newer
+ * builds may add data without breaking older ones; the version only changes when the
+ * meaning of existing data does. Host pointers, padding and keypad state are never stored.
+ */
+#define SAVE_STATE_VERSION 1
+#define SAVE_STATE_HEADER_SIZE 12
+#define SAVE_STATE_CHUNK_HEADER_SIZE 8
+#define SAVE_STATE_CPU_SIZE (16 + 2 + 2 + 4 + 2 * STACK_SIZE + 8)
+#define SAVE_STATE_LORES_DISPLAY_SIZE (4 + 8 * (DISPLAY_HEIGHT / 2))
+#define SAVE_STATE_MAX_DISPLAY_SIZE (4 + 8 * DISPLAY_HEIGHT * DISPLAY_WORDS)
+#define SAVE_STATE_XO_SIZE (3 + AUDIO_PATTERN_SIZE)
+#define SAVE_STATE_MAX_SIZE (SAVE_STATE_HEADER_SIZE + 7 * SAVE_STATE_CHUNK_HEADER_SIZE + 4 + SAVE_STATE_CPU_SIZE \
+                             + RAM_SIZE + 2 * SAVE_STATE_MAX_DISPLAY_SIZE + RPL_FLAGS + SAVE_STATE_XO_SIZE + 4)
+
+static uint8_t *put16(uint8_t *cursor, uint16_t value) {
+    cursor[0] = value & 0xFF;
+    cursor[1] = value >> 8;
+    return cursor + 2;
+}
+
+static uint8_t *put32(uint8_t *cursor, uint32_t value) {
+    put16(cursor, value & 0xFFFF);
+    return put16(cursor + 2, value >> 16);
+}
+
+static uint8_t *put64(uint8_t *cursor, uint64_t value) {
+    put32(cursor, value & 0xFFFFFFFF);
+    return put32(cursor + 4, value >> 32);
+}
+
+static uint8_t *put_chunk_header(uint8_t *cursor, const char tag[4], uint32_t length) {
+    memcpy(cursor, tag, 4);
+    return put32(cursor + 4, length);
+}
+
+static uint16_t get16(const uint8_t *cursor) {
+    return cursor[0] | (uint16_t)cursor[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *cursor) {
+    return get16(cursor) | (uint32_t)get16(cursor + 2) << 16;
+}
+
+static uint64_t get64(const uint8_t *cursor) {
+    return get32(cursor) | (uint64_t)get32(cursor + 4) << 32;
+}
+
+// Display chunk of one plane; only the part of the display in use, so low resolution states keep their original layout
+static uint8_t *put_display(uint8_t *cursor, const char tag[4], const struct EmulatedSystem *emulated_system, uint32_t plane) {
+    const uint32_t width = emulated_display_width(emulated_system), height = emulated_display_height(emulated_system);
+
+    cursor = put_chunk_header(cursor, tag, 4 + 8 * height * (width / 64));
+    cursor = put16(cursor, width);
+    cursor = put16(cursor, height);
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t word = 0; word < width / 64; word++) cursor = put64(cursor, emulated_system->display[plane][y][word]);
+    return cursor;
+}
+
+bool emulated_save_state(const struct EmulatedSystem *emulated_system, uint32_t ram_size, const char *filename) {
+    uint8_t buffer[SAVE_STATE_MAX_SIZE];
+    uint8_t *cursor = buffer;
+
+    memcpy(cursor, "TC8S", 4);
+    cursor = put16(cursor + 4, SAVE_STATE_VERSION);
+    cursor = put16(cursor, 0);
+    cursor += 4; // chunks length, once known
+
+    cursor = put_chunk_header(cursor, "ROM ", 4);
+    cursor = put32(cursor, emulated_system->rom_crc);
+
+    cursor = put_chunk_header(cursor, "CPU ", SAVE_STATE_CPU_SIZE);
+    memcpy(cursor, emulated_system->V, 16);
+    cursor = put16(cursor + 16, emulated_system->I);
+    cursor = put16(cursor, emulated_system->PC);
+    *cursor++ = emulated_system->delay_timer;
+    *cursor++ = emulated_system->sound_timer;
+    *cursor++ = emulated_system->awaited_key;
+    *cursor++ = emulated_system->stack_depth;
+    for (int i = 0; i < STACK_SIZE; i++) cursor = put16(cursor, emulated_system->stack[i]);
+    cursor = put64(cursor, emulated_system->random_state);
+
+    if (ram_size > RAM_SIZE) ram_size = RAM_SIZE;
+    cursor = put_chunk_header(cursor, "RAM ", ram_size);
+    memcpy(cursor, emulated_system->ram, ram_size);
+    cursor += ram_size;
+
+    cursor = put_display(cursor, "DISP", emulated_system, 0);
+
+    cursor = put_chunk_header(cursor, "RPL ", RPL_FLAGS);
+    memcpy(cursor, emulated_system->rpl, RPL_FLAGS);
+    cursor += RPL_FLAGS;
+
+    // XO-CHIP machines only, so CHIP-8 and SUPER-CHIP states keep their original layout
+    if (ram_size > CHIP8_RAM_SIZE) {
+        cursor = put_display(cursor, "DSP2", emulated_system, 1);
+        cursor = put_chunk_header(cursor, "XO  ", SAVE_STATE_XO_SIZE);
+        *cursor++ = emulated_system->planes;
+        *cursor++ = emulated_system->pitch;
+        *cursor++ = emulated_system->has_audio_pattern;
+        memcpy(cursor, emulated_system->audio_pattern, AUDIO_PATTERN_SIZE);
+        cursor += AUDIO_PATTERN_SIZE;
+    }
+
+    put32(buffer + 8, (uint32_t)(cursor - buffer - SAVE_STATE_HEADER_SIZE));
+    cursor = put32(cursor, emulated_crc32(buffer, cursor - buffer));
+
     FILE *file = fopen(filename, "wb");
     if (!file) return false;
-    else if (fwrite(emulated_system, sizeof(struct EmulatedSystem), 1, file) != 1) {
-        fclose(file);
+    const bool written = fwrite(buffer, cursor - buffer, 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
+
+// Validates the save state in data and, only if it is complete and consistent, copies it into the machine
+static bool emulated_parse_state(struct EmulatedSystem *emulated_system, uint32_t ram_size, const uint8_t *data,
+                                 size_t size, const char *filename) {
+    if (size < SAVE_STATE_HEADER_SIZE + 4 || memcmp(data, "TC8S", 4) != 0) {
+        fprintf(stderr, "%s não é um save do tracua-chip8\n", filename);
+        return false;
+    }
+    if (get16(data + 4) > SAVE_STATE_VERSION) {
+        fprintf(stderr, "O save %s é de uma versão mais nova (%u)\n", filename, get16(data + 4));
+        return false;
+    }
+
+    const uint32_t chunks_size = get32(data + 8);
+    if (chunks_size > size - SAVE_STATE_HEADER_SIZE - 4) {
+        fprintf(stderr, "O save %s está incompleto\n", filename);
+        return false;
+    }
+    const size_t crc_offset = SAVE_STATE_HEADER_SIZE + chunks_size;
+    if (get32(data + crc_offset) != emulated_crc32(data, crc_offset)) {
+        fprintf(stderr, "O save %s está corrompido (CRC)\n", filename);
+        return false;
+    }
+
+    const uint8_t *rom = NULL, *cpu = NULL, *ram = NULL, *display = NULL, *rpl = NULL, *display2 = NULL, *xo = NULL;
+    uint32_t ram_length = 0, display_length = 0, display2_length = 0;
+    for (size_t offset = SAVE_STATE_HEADER_SIZE; offset < crc_offset;) {
+        if (crc_offset - offset < SAVE_STATE_CHUNK_HEADER_SIZE) break;
+        const uint8_t *tag = data + offset;
+        const uint32_t length = get32(tag + 4);
+        const uint8_t *payload = tag + SAVE_STATE_CHUNK_HEADER_SIZE;
+        offset += SAVE_STATE_CHUNK_HEADER_SIZE;
+        if (length > crc_offset - offset) {
+            fprintf(stderr, "O save %s tem um bloco inválido\n", filename);
+            return false;
+        }
+        offset += length;
+
+        if (memcmp(tag, "ROM ", 4) == 0 && length >= 4) rom = payload;
+        else if (memcmp(tag, "CPU ", 4) == 0 && length >= SAVE_STATE_CPU_SIZE) cpu = payload;
+        else if (memcmp(tag, "RAM ", 4) == 0) {
+            ram = payload;
+            ram_length = length;
+        }
+        else if (memcmp(tag, "DISP", 4) == 0 && length >= SAVE_STATE_LORES_DISPLAY_SIZE) {
+            display = payload;
+            display_length = length;
+        }
+        else if (memcmp(tag, "RPL ", 4) == 0 && length >= RPL_FLAGS) rpl = payload;
+        else if (memcmp(tag, "DSP2", 4) == 0 && length >= SAVE_STATE_LORES_DISPLAY_SIZE) {
+            display2 = payload;
+            display2_length = length;
+        }
+        else if (memcmp(tag, "XO  ", 4) == 0 && length >= SAVE_STATE_XO_SIZE) xo = payload;
+    }
+
+    if (!rom || !cpu || !ram || !display) {
+        fprintf(stderr, "O save %s não tem todos os dados da máquina\n", filename);
+        return false;
+    }
+    if (get32(rom) != emulated_system->rom_crc) {
+        fprintf(stderr, "O save %s é de outra ROM\n", filename);
+        return false;
+    }
+    // The RAM saved is what the machine addresses: 4 KB, or 64 KB for XO-CHIP
+    if (ram_length != (ram_size > RAM_SIZE ? RAM_SIZE : ram_size)) {
+        fprintf(stderr, "O save %s é de uma máquina com outra memória (%u bytes)\n", filename, ram_length);
         return false;
     }
-    else {
-        fclose(file);
-        return true;
+    const uint16_t width = get16(display), height = get16(display + 2);
+    const bool hires = width == DISPLAY_WIDTH && height == DISPLAY_HEIGHT;
+    if (!(hires || (width == DISPLAY_WIDTH / 2 && height == DISPLAY_HEIGHT / 2))
+        || display_length < 4 + 8u * height * (width / 64)
+        || (display2 && (get16(display2) != width || get16(display2 + 2) != height
+                         || display2_length < 4 + 8u * height * (width / 64)))) {
+        fprintf(stderr, "O save %s tem uma tela de tamanho diferente\n", filename);
+        return false;
+    }
+    const uint8_t stack_depth = cpu[23];
+    const uint16_t PC = get16(cpu + 18);
+    const uint8_t awaited_key = cpu[22];
+    if (stack_depth > STACK_SIZE || PC >= ram_length || (awaited_key != 0xFF && awaited_key >= 16)) {
+        fprintf(stderr, "O save %s tem registradores inválidos\n", filename);
+        return false;
     }
+
+    memcpy(emulated_system->V, cpu, 16);
+    emulated_system->I = get16(cpu + 16);
+    emulated_system->PC = PC;
+    emulated_system->delay_timer = cpu[20];
+    emulated_system->sound_timer = cpu[21];
+    emulated_system->awaited_key = awaited_key;
+    emulated_system->stack_depth = stack_depth;
+    for (int i = 0; i < STACK_SIZE; i++) emulated_system->stack[i] = get16(cpu + 24 + 2 * i);
+    emulated_system->random_state = get64(cpu + 24 + 2 * STACK_SIZE);
+    memcpy(emulated_system->ram, ram, ram_length);
+    memset(emulated_system->ram + ram_length, 0, RAM_SIZE - ram_length);
+    memset(emulated_system->display, 0, sizeof emulated_system->display);
+    for (uint32_t y = 0; y < height; y++)
+        for (uint32_t word = 0; word < width / 64u; word++) {
+            emulated_system->display[0][y][word] = get64(display + 4 + 8 * (y * (width / 64) + word));
+            if (display2) emulated_system->display[1][y][word] = get64(display2 + 4 + 8 * (y * (width / 64) + word));
+        }
+    emulated_system->hires = hires;
+    if (rpl) memcpy(emulated_system->rpl, rpl, RPL_FLAGS);
+    emulated_system->planes = xo ? xo[0] & 3 : 1;
+    emulated_system->pitch = xo ? xo[1] : AUDIO_DEFAULT_PITCH;
+    emulated_system->has_audio_pattern = xo && xo[2];
+    if (xo) memcpy(emulated_system->audio_pattern, xo + 3, AUDIO_PATTERN_SIZE);
+    else memset(emulated_system->audio_pattern, 0, AUDIO_PATTERN_SIZE);
+    return true;
 }
 
-bool emulated_load_state(struct EmulatedSystem *emulated_system, const char *filename) {
-    FILE *file = fopen(filename, "rb");
+bool emulated_load_state(struct EmulatedSystem *emulated_system, uint32_t ram_size, const char *filename) {
+    const int file = open(filename, O_RDONLY);
+    struct stat file_status;
 
-    if (!file) {
+    if (file < 0) {
       fprintf(stderr, "Não foi possível encontrar o save %s\n", filename);
       return false;
     }
-    else if (fread(emulated_system, sizeof(struct EmulatedSystem), 1, file) != 1) {
+    if (fstat(file, &file_status) != 0 || file_status.st_size < SAVE_STATE_HEADER_SIZE + 4) {
         fprintf(stderr, "Não foi possível ler o save %s\n", filename);
-        fclose(file);
+        close(file);
         return false;
     }
-    else {
-        fclose(file);
-        return true;
+
+    const size_t size = (size_t)file_status.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Não foi possível ler o save %s\n", filename);
+        return false;
     }
-}
\ No newline at end of file
+
+    const bool loaded = emulated_parse_state(emulated_system, ram_size, data, size, filename);
+    munmap(data, size);
+    return loaded;
+}
@@ -0,0 +1,174 @@
+// Emulation thread
+
+#include "emulation_thread.h"
+#include "headless.h" // emulator_headless_now_ns()
+#include "movie.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SNAPSHOT_FRESH 4 // flag in middle, next to the slot index
+
+// Emulates several frames in one tick. Each is a whole frame (its instructions, then one timer step);
+// uncapped, frames run until most of the tick is used.
+static void emulator_thread_fast_forward(struct Emulator *emulator, uint32_t multiplier) {
+    const uint64_t deadline = emulator_headless_now_ns() + 15000000;
+
+    for (uint32_t frame = 0; emulator->emulated_system.state == RUNNING; frame++) {
+        if (multiplier != 0 ? frame >= multiplier : emulator_headless_now_ns() >= deadline) break;
+        emulator_update(emulator);
+    }
+}
+
+// Runs one frame in input_slices parts spread over its 1/60 s, so that key presses are seen by the instructions
+// of the same frame
+static void emulator_thread_run_sliced_frame(struct EmulationThread *thread, const struct Scheduler *scheduler) {
+    struct Emulator *emulator = thread->emulator;
+    const uint64_t start = emulator_scheduler_deadline(scheduler, scheduler->frames - 1);
+    const uint64_t period = emulator_scheduler_deadline(scheduler, scheduler->frames) - start;
+
+    emulator_begin_frame(emulator);
+    const uint64_t instructions = emulator->frame_instructions_left;
+    uint64_t done = 0;
+    for (uint32_t slice = 1; slice < thread->input_slices && emulator->emulated_system.state == RUNNING; slice++) {
+        const uint64_t target = instructions * slice / thread->input_slices;
+        emulator_run_instructions(emulator, target - done);
+        done = target;
+        emulator_scheduler_sleep_until(start + period * slice / thread->input_slices);
+    }
+    emulator_end_frame(emulator);
+}
+
+static void emulator_thread_publish(struct EmulationThread *thread, const struct Scheduler *scheduler) {
+    const struct Emulator *emulator = thread->emulator;
+    struct FrameSnapshot *snapshot = &thread->snapshots[thread->back];
+
+    memcpy(snapshot->display, emulator->emulated_system.display, sizeof snapshot->display);
+    snapshot->hires = emulator->emulated_system.hires;
+    snapshot->sound = emulator->should_play_sound;
+    snapshot->frame = emulator->frames_executed;
+    snapshot->measured_instructions_per_second = scheduler->measured_instructions_per_second;
+    snapshot->instructions_per_second = emulator->instructions_per_second;
+
+    thread->back = atomic_exchange_explicit(&thread->middle, thread->back | SNAPSHOT_FRESH, memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+}
+
+// Nothing to do until the front-end changes a control: neither emulating, rewinding nor a request to handle
+static bool emulator_thread_has_nothing_to_do(struct EmulationControls *controls) {
+    return !atomic_load_explicit(&controls->quit, memory_order_acquire)
+           && (atomic_load_explicit(&controls->paused, memory_order_relaxed) || atomic_load_explicit(&controls->idle, memory_order_relaxed))
+           && !atomic_load_explicit(&controls->rewinding, memory_order_relaxed)
+           && !atomic_load_explicit(&controls->save_state, memory_order_acquire)
+           && !atomic_load_explicit(&controls->load_state, memory_order_acquire);
+}
+
+void emulator_controls_wake(struct EmulationControls *controls) {
+    pthread_mutex_lock(&controls->lock);
+    pthread_cond_signal(&controls->resume);
+    pthread_mutex_unlock(&controls->lock);
+}
+
+static void *emulator_thread_run(void *argument) {
+    struct EmulationThread *thread = argument;
+    struct Emulator *emulator = thread->emulator;
+    struct EmulationControls *controls = &thread->controls;
+    bool movie_finished = !emulator->movie || emulator_movie_finished(emulator->movie);
+    struct Scheduler scheduler;
+
+    emulator_scheduler_start(&scheduler, emulator_headless_now_ns(), emulator->instructions_executed);
+    emulator_thread_publish(thread, &scheduler);
+
+    // One pass per 60hz tick: requests, then the frames that are due (more than one after a hiccup)
+    while (!atomic_load_explicit(&controls->quit, memory_order_acquire)) {
+        if (emulator_thread_has_nothing_to_do(controls)) {
+            // The controls are stored before emulator_controls_wake() takes the lock, so no wake-up is missed
+            pthread_mutex_lock(&controls->lock);
+            while (emulator_thread_has_nothing_to_do(controls)) pthread_cond_wait(&controls->resume, &controls->lock);
+            pthread_mutex_unlock(&controls->lock);
+            emulator_scheduler_restart(&scheduler, emulator_headless_now_ns()); // the ticks slept through are not due
+        }
+
+        const uint32_t frames_due = emulator_scheduler_frames_due(&scheduler, emulator_headless_now_ns());
+        bool changed = false;
+
+        if (atomic_exchange_explicit(&controls->save_state, false, memory_order_acq_rel))
+            puts(emulator_save_state(emulator, "save_state.bin") ? "State saved successfully." : "Failed to save state.");
+        if (atomic_exchange_explicit(&controls->load_state, false, memory_order_acq_rel)) {
+            changed = emulator_load_state(emulator, "save_state.bin");
+            puts(changed ? "State loaded successfully." : "Failed to load state.");
+        }
+
+        if (frames_due == 0) {} // woken early
+        else if (atomic_load_explicit(&controls->rewinding, memory_order_relaxed)) changed |= emulator_rewind(emulator);
+        else if (!atomic_load_explicit(&controls->paused, memory_order_relaxed) && !atomic_load_explicit(&controls->idle, memory_order_relaxed)) {
+            if (atomic_load_explicit(&controls->fast_forward, memory_order_relaxed))
+                emulator_thread_fast_forward(emulator, atomic_load_explicit(&controls->fast_forward_multiplier, memory_order_relaxed));
+            else {
+                // Late frames run whole, the current one is spread over its time
+                for (uint32_t frame = 1; frame < frames_due && emulator->emulated_system.state == RUNNING; frame++) emulator_update(emulator);
+                if (emulator->emulated_system.state == RUNNING) emulator_thread_run_sliced_frame(thread, &scheduler);
+            }
+            changed = true;
+        }
+
+        if (!movie_finished && emulator_movie_finished(emulator->movie)) {
+            puts("Movie finished, the keyboard is back in control.");
+            movie_finished = true;
+        }
+        if (emulator->emulated_system.state == QUIT) atomic_store_explicit(&controls->quit, true, memory_order_release);
+
+        changed |= emulator_scheduler_measure(&scheduler, emulator_headless_now_ns(), emulator->instructions_executed);
+        if (changed) emulator_thread_publish(thread, &scheduler);
+        emulator_scheduler_wait(&scheduler);
+    }
+    return NULL;
+}
+
+void emulator_thread_initialize(struct EmulationThread *thread, struct Emulator *emulator) {
+    memset(thread, 0, sizeof *thread);
+    thread->emulator = emulator;
+    thread->input_slices = EMULATION_DEFAULT_INPUT_SLICES;
+    emulator->input = &thread->controls.input;
+    atomic_init(&thread->controls.input.keypad, 0);
+    for (int key = 0; key < 16; key++) atomic_init(&thread->controls.input.pressed_ns[key], 0);
+    atomic_init(&thread->controls.quit, false);
+    atomic_init(&thread->controls.paused, false);
+    atomic_init(&thread->controls.idle, false);
+    atomic_init(&thread->controls.rewinding, false);
+    atomic_init(&thread->controls.fast_forward, false);
+    atomic_init(&thread->controls.fast_forward_multiplier, 0);
+    atomic_init(&thread->controls.save_state, false);
+    atomic_init(&thread->controls.load_state, false);
+    pthread_mutex_init(&thread->controls.lock, NULL);
+    pthread_cond_init(&thread->controls.resume, NULL);
+    thread->back = 0;
+    atomic_init(&thread->middle, 1);
+    thread->front = 2;
+    thread->has_frame = false;
+}
+
+bool emulator_thread_start(struct EmulationThread *thread) {
+    if (pthread_create(&thread->thread, NULL, emulator_thread_run, thread) != 0) {
+        fprintf(stderr, "Could not start the emulation thread\n");
+        return false;
+    }
+    return true;
+}
+
+const struct FrameSnapshot *emulator_thread_latest_frame(struct EmulationThread *thread, bool *fresh) {
+    *fresh = (atomic_load_explicit(&thread->middle, memory_order_relaxed) & SNAPSHOT_FRESH) != 0;
+    if (*fresh) {
+        thread->front = atomic_exchange_explicit(&thread->middle, thread->front, memory_order_acq_rel) & ~SNAPSHOT_FRESH;
+        thread->has_frame = true;
+    }
+    return thread->has_frame ? &thread->snapshots[thread->front] : NULL;
+}
+
+void emulator_thread_stop(struct EmulationThread *thread) {
+    atomic_store_explicit(&thread->controls.quit, true, memory_order_release);
+    emulator_controls_wake(&thread->controls);
+    pthread_join(thread->thread, NULL);
+    pthread_cond_destroy(&thread->controls.resume);
+    pthread_mutex_destroy(&thread->controls.lock);
+}
@@ -1,8 +1,31 @@
 // Emulator
 
 #include "emulator.h"
+#include "jit.h"
+#include "movie.h"
+#include "beeper.h"
+#include "capture.h"
+#include "headless.h" // emulator_headless_now_ns()
+#include "profile.h"
+#include "trace.h"
+#include "rewind.h"
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static bool emulator_emulate_instruction_instrumented(struct Emulator *emulator);
+static uint32_t emulator_emulate_fused(struct Emulator *emulator, uint64_t remaining_instructions);
+
+bool emulator_load_rom_from_memory(struct Emulator *emulator, const uint8_t *rom, size_t rom_size) {
+    const size_t max_size = emulator_ram_size(emulator) - emulated_system_entry_point;
+    if (rom_size > max_size) return false;
+
+    memcpy(&emulator->emulated_system.ram[emulated_system_entry_point], rom, rom_size);
+    emulator->emulated_system.rom_crc = emulated_crc32(rom, rom_size);
+    emulator_invalidate_decoded_instructions(emulator, emulated_system_entry_point, rom_size);
+    return true;
+}
 
 bool emulator_load_rom(struct Emulator *emulator, const char* rom_name) {
     // Open ROM file
@@ -15,9 +38,10 @@ bool emulator_load_rom(struct Emulator *emulator, const char* rom_name) {
     // Get/check rom size
     fseek(rom, 0, SEEK_END);
     const size_t rom_size = ftell(rom);
-    const size_t max_size = sizeof emulator->emulated_system.ram - emulated_system_entry_point;
+    const size_t max_size = emulator_ram_size(emulator) - emulated_system_entry_point;
     rewind(rom);
 
+    uint8_t data[RAM_SIZE];
     if (rom_size > max_size) {
         fprintf(stderr, "Rom file %s is too big! Rom size: %llu, Max size allowed: %llu\n", 
                 rom_name, (long long unsigned)rom_size, (long long unsigned)max_size);
@@ -25,7 +49,7 @@ bool emulator_load_rom(struct Emulator *emulator, const char* rom_name) {
         return false;
     }
     // Load ROM
-    else if (fread(&emulator->emulated_system.ram[emulated_system_entry_point], rom_size, 1, rom) != 1) {
+    else if (fread(data, rom_size, 1, rom) != 1) {
         fprintf(stderr, "Could not read Rom file %s into CHIP8 memory\n", 
                 rom_name);
         fclose(rom);
@@ -33,6 +57,7 @@ bool emulator_load_rom(struct Emulator *emulator, const char* rom_name) {
     }
     else {
         emulator->rom_name = rom_name;
+        emulator_load_rom_from_memory(emulator, data, rom_size);
         fclose(rom);
         return true;
     }
@@ -43,377 +68,1078 @@ bool emulator_load_rom(struct Emulator *emulator, const char* rom_name) {
 bool emulator_initialize(struct Emulator *emulator) {
     memset(&emulator->emulated_system, 0, sizeof(struct EmulatedSystem)); // clean start
     memcpy(&emulator->emulated_system.ram, emulated_system_font, sizeof(emulated_system_font)); // Load font
+    memcpy(&emulator->emulated_system.ram[emulated_system_large_font_address], emulated_system_large_font,
+           sizeof(emulated_system_large_font));
 
     // Set defaults
     emulator->emulated_system.state = RUNNING;
     emulator->emulated_system.PC = emulated_system_entry_point;
-    emulator->emulated_system.stack_ptr = &emulator->emulated_system.stack[0];
+    emulator->emulated_system.awaited_key = 0xFF;
+    emulator->emulated_system.planes = 1;
+    emulator->emulated_system.pitch = AUDIO_DEFAULT_PITCH;
+    emulated_seed_random(&emulator->emulated_system, 0);
     emulator->instructions_per_second = 600;
+    emulator->instruction_remainder = 0;
+    emulator->frame_instructions_left = 0;
     emulator->extension = CHIP8;
-
-    emulator_user_interface_initialize(&emulator->user_interface, &emulator->emulated_system);
-    emulator_user_interface_clear_screen(&emulator->user_interface);
+    emulator->should_play_sound = false;
+    emulator->skip_idle_loops = true;
+    emulator->idle_loop_length = 0;
+    emulator->instructions_executed = 0;
+    emulator->frames_executed = 0;
+    emulator->instructions_skipped = 0;
+    memset(emulator->decoded_instructions, 0, sizeof emulator->decoded_instructions);
+    emulator->cpu = CPU_INTERPRETER;
+    emulator->jit = NULL;
+    emulator->rewind = NULL;
+    emulator->movie = NULL;
+    emulator->beeper = NULL;
+    emulator->capture = NULL;
+    emulator->input = NULL;
+    emulator->profile = NULL;
+    emulator->trace = NULL;
 
     return true;
 }
 
-void emulator_update(struct Emulator *emulator) {
-    static const float frame_duration = 1000.0f / 60;
-    uint64_t remaining_instructions = emulator->instructions_per_second / 60;
+// Length in instructions of the loop at PC if it can not change the machine before the next timer tick or key
+// event, 0 otherwise: a jump to itself, or FX07 / 3XNN (4XNN) / 1NNN back to the FX07 once VX holds the delay
+// timer and the skip is not taken
+static uint8_t emulator_idle_loop_length(const struct Emulator *emulator) {
+    const struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint16_t PC = chip8->PC;
+    const uint16_t jump_back = 0x1000 | PC;
+
+    if (PC >= CHIP8_RAM_SIZE - 7) return 0; // 1NNN only reaches the first 4 kilobytes
+    const uint16_t first = chip8->ram[PC] << 8 | chip8->ram[PC + 1];
+    if (first == jump_back) return 1;
+    if ((first & 0xF0FF) != 0xF007) return 0;
+
+    const uint8_t X = (first >> 8) & 0x0F;
+    const uint16_t test = chip8->ram[PC + 2] << 8 | chip8->ram[PC + 3];
+    const uint16_t last = chip8->ram[PC + 4] << 8 | chip8->ram[PC + 5];
+    if (last != jump_back || chip8->V[X] != chip8->delay_timer) return 0;
+
+    if ((test & 0xFF00) == (0x3000 | X << 8) && (test & 0xFF) != chip8->delay_timer) return 3;
+    if ((test & 0xFF00) == (0x4000 | X << 8) && (test & 0xFF) == chip8->delay_timer) return 3;
+    return 0;
+}
+
+// Counts the whole loops that fit in the remaining instructions as executed, leaving the machine exactly where
+// running them would; returns the instructions still to run
+static uint64_t emulator_skip_idle_loop(struct Emulator *emulator, uint64_t remaining_instructions) {
+    const uint64_t skipped = remaining_instructions - remaining_instructions % emulator->idle_loop_length;
+
+    emulator->idle_loop_length = 0;
+    emulator->instructions_executed += skipped;
+    emulator->instructions_skipped += skipped;
+    return remaining_instructions - skipped;
+}
 
-    emulator->user_interface.expected_moment_to_draw = SDL_GetTicks64() + frame_duration;
+// Copies the live keypad, when the front-end provides one, into the machine
+static inline void emulator_load_keypad(struct Emulator *emulator) {
+    if (!emulator->input) return;
 
-    // Instruction cycle (many of these occur each second)
-    while (remaining_instructions > 0) {
-        remaining_instructions--;
-        emulator_emulate_instruction(emulator);
+    const uint16_t keypad = atomic_load_explicit(&emulator->input->keypad, memory_order_relaxed);
+    for (int key = 0; key < 16; key++) emulator->emulated_system.keypad[key] = (keypad >> key) & 1;
+}
+
+// Same, in the middle of a frame. Not while a movie is recorded or played: it holds the keypad of whole frames,
+// sampled at their start.
+static inline void emulator_sample_input(struct Emulator *emulator) {
+    if (!emulator->movie) emulator_load_keypad(emulator);
+}
+
+void emulator_begin_frame(struct Emulator *emulator) {
+    emulator->instruction_remainder += emulator->instructions_per_second % 60;
+    emulator->frame_instructions_left = emulator->instructions_per_second / 60 + emulator->instruction_remainder / 60;
+    emulator->instruction_remainder %= 60;
+
+    emulator->idle_loop_length = 0;
+
+    emulator_load_keypad(emulator);
+    if (emulator->movie) emulator_movie_frame(emulator->movie, &emulator->emulated_system);
+
+    if (emulator->cpu == CPU_JIT && !emulator->jit) {
+        emulator->jit = emulator_jit_create();
+        if (!emulator->jit) {
+            fprintf(stderr, "Recompiler unavailable, using the interpreter\n");
+            emulator->cpu = CPU_INTERPRETER;
+        }
     }
 
+    if (emulator->trace) emulator_trace_frame(emulator->trace, emulator->frames_executed, &emulator->emulated_system);
+}
+
+void emulator_run_instructions(struct Emulator *emulator, uint64_t count) {
+    uint64_t remaining_instructions = count < emulator->frame_instructions_left ? count : emulator->frame_instructions_left;
+
+    emulator->frame_instructions_left -= remaining_instructions;
+    emulator_sample_input(emulator); // compiled code reads the keypad sampled here
+
+    // Instruction cycle (many of these occur each second). An idle loop is skipped to the end of this run only,
+    // so a key pressed meanwhile is seen by the next one.
+    if (emulator->profile || emulator->trace) {
+        const uint64_t start = emulator_headless_now_ns();
+
+        while (remaining_instructions > 0 && emulator->emulated_system.state != QUIT) {
+            remaining_instructions--;
+            emulator_emulate_instruction_instrumented(emulator);
+            emulator->instructions_executed++;
+        }
+
+        if (emulator->profile) emulator->profile->emulation_ns += emulator_headless_now_ns() - start;
+    }
+    else if (emulator->cpu == CPU_JIT) {
+        while (remaining_instructions > 0 && emulator->emulated_system.state != QUIT) {
+            uint32_t executed = emulator_jit_execute(emulator, remaining_instructions);
+            if (executed == 0) {
+                emulator_emulate_instruction(emulator);
+                executed = 1;
+            }
+            else if (emulator->skip_idle_loops) {
+                emulator->idle_loop_length = emulator_idle_loop_length(emulator); // compiled jumps skip the handler
+            }
+            remaining_instructions -= executed;
+            emulator->instructions_executed += executed;
+            if (emulator->idle_loop_length) remaining_instructions = emulator_skip_idle_loop(emulator, remaining_instructions);
+        }
+    }
+    else {
+        while (remaining_instructions > 0 && emulator->emulated_system.state != QUIT) {
+            const uint32_t executed = emulator_emulate_fused(emulator, remaining_instructions);
+            remaining_instructions -= executed;
+            emulator->instructions_executed += executed;
+            if (emulator->idle_loop_length) remaining_instructions = emulator_skip_idle_loop(emulator, remaining_instructions);
+        }
+    }
+}
+
+void emulator_end_frame(struct Emulator *emulator) {
+    if (emulator->frame_instructions_left > 0) emulator_run_instructions(emulator, emulator->frame_instructions_left);
+
     // Update timers
     if (emulator->emulated_system.delay_timer > 0) emulator->emulated_system.delay_timer--;
 
     if (emulator->emulated_system.sound_timer > 0) {
         emulator->emulated_system.sound_timer--;
-        emulator->user_interface.should_play_sound = true;
+        emulator->should_play_sound = true;
     }
     else {
-        emulator->user_interface.should_play_sound = false;
+        emulator->should_play_sound = false;
+    }
+
+    if (emulator->beeper) {
+        const struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+        emulator_beeper_push(emulator->beeper, emulator->frames_executed, emulator->should_play_sound,
+                             emulated_system->has_audio_pattern ? emulated_system->audio_pattern : NULL, emulated_system->pitch);
     }
+    if (emulator->capture) emulator_capture_frame(emulator->capture, &emulator->emulated_system);
+    if (emulator->profile) emulator->profile->frames++;
+    emulator->frames_executed++;
 
-    // Update user interface
-    emulator_user_interface_update(&emulator->user_interface, &emulator->emulated_system);
+    if (emulator->rewind) emulator_rewind_capture(emulator->rewind, &emulator->emulated_system);
 }
 
-bool emulator_emulate_instruction(struct Emulator *emulator) {
-    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
-    struct EmulatedSystem *chip8 = emulated_system; // TODO: remove this
-    bool should_draw = false;
-    bool carry; // valor carry flag/VF
+void emulator_update(struct Emulator *emulator) {
+    emulator_begin_frame(emulator);
+    emulator_end_frame(emulator);
+}
 
-    // Get next opcode from ram 
-    emulated_system->instruction.opcode = (emulated_system->ram[emulated_system->PC] << 8) | emulated_system->ram[emulated_system->PC+1];
+// Instruction handlers. Each one receives operands already extracted by emulator_decode_instruction()
+// and returns true when the display was modified.
 
-    emulated_system->PC += 2;
+static bool emulator_execute_invalid(struct Emulator *emulator, const struct Instruction *instruction) {
+    (void)emulator; (void)instruction;
+    return false; // Opcode inválido
+}
 
-    emulated_system->instruction.NNN = emulated_system->instruction.opcode & 0x0FFF;
-    emulated_system->instruction.NN = emulated_system->instruction.opcode & 0x0FF;
-    emulated_system->instruction.N = emulated_system->instruction.opcode & 0x0F;
-    emulated_system->instruction.X = (emulated_system->instruction.opcode >> 8) & 0x0F;
-    emulated_system->instruction.Y = (emulated_system->instruction.opcode >> 4) & 0x0F;
+static inline bool emulator_plane_selected(const struct EmulatedSystem *emulated_system, uint32_t plane) {
+    return emulated_system->planes & (1u << plane);
+}
 
-    if (emulated_system->PC >= 4095) {
-        SDL_Log("PC fora do limite: %04X\n", emulated_system->PC);
-        emulated_system->state = QUIT;
-        return should_draw;
+static bool emulator_execute_00E0(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00E0: Clear (XO-CHIP: the selected planes)
+    (void)instruction;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+        if (emulator_plane_selected(chip8, plane)) memset(chip8->display[plane], 0, sizeof chip8->display[plane]);
+    return true;
+}
+
+static bool emulator_execute_00CN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00CN: Scroll down N rows (SUPER-CHIP), 0x00DN: scroll up N rows (XO-CHIP); one block move per plane
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t height = emulated_display_height(chip8);
+    const uint32_t rows = instruction->N < height ? instruction->N : height;
+    const size_t row_size = sizeof chip8->display[0][0];
+
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!emulator_plane_selected(chip8, plane)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = chip8->display[plane];
+
+        if (instruction->Y == 0xC) {
+            memmove(&display[rows], &display[0], (height - rows) * row_size);
+            memset(&display[0], 0, rows * row_size);
+        }
+        else {
+            memmove(&display[0], &display[rows], (height - rows) * row_size);
+            memset(&display[height - rows], 0, rows * row_size);
+        }
     }
+    return true;
+}
 
-    // Emulate opcode
-    switch ((emulated_system->instruction.opcode >> 12) & 0x0F) {
-        case 0x00:
-            if (emulated_system->instruction.NN == 0xE0) {
-                // 0x00E0: Clear
-                memset(&emulated_system->display[0], false, sizeof emulated_system->display);
-                should_draw = true;
-            } else if (emulated_system->instruction.NN == 0xEE) {
-                // 0x00EE: Retorna de subrotina
-                emulated_system->PC = *--emulated_system->stack_ptr;
+static bool emulator_execute_00FB(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00FB: Scroll right 4 pixels (SUPER-CHIP); whole rows are shifted, pixels carried across the words
+    (void)instruction;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
 
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!emulator_plane_selected(chip8, plane)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = chip8->display[plane];
+
+        if (chip8->hires) {
+            for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++) {
+                display[y][1] = display[y][1] >> 4 | display[y][0] << 60;
+                display[y][0] >>= 4;
             }
-            break;
+        }
+        else {
+            for (uint32_t y = 0; y < DISPLAY_HEIGHT / 2; y++) display[y][0] >>= 4;
+        }
+    }
+    return true;
+}
 
-        case 0x01:
-            // 0x1NNN: Pulo para NNN
-            emulated_system->PC = emulated_system->instruction.NNN;
-            break;
+static bool emulator_execute_00FC(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00FC: Scroll left 4 pixels (SUPER-CHIP)
+    (void)instruction;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
 
-        case 0x02:
-            // 0x2NNN: subrotina em NNN
-            *emulated_system->stack_ptr++ = emulated_system->PC;  
-            emulated_system->PC = emulated_system->instruction.NNN;
-            break;
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!emulator_plane_selected(chip8, plane)) continue;
+        uint64_t (*display)[DISPLAY_WORDS] = chip8->display[plane];
 
-        case 0x03:
-            // 0x3XNN: Check if VX == NN, if so, skip the next instruction
-            if (emulated_system->V[emulated_system->instruction.X] == emulated_system->instruction.NN)
-                emulated_system->PC += 2;
-            break;
+        if (chip8->hires) {
+            for (uint32_t y = 0; y < DISPLAY_HEIGHT; y++) {
+                display[y][0] = display[y][0] << 4 | display[y][1] >> 60;
+                display[y][1] <<= 4;
+            }
+        }
+        else {
+            for (uint32_t y = 0; y < DISPLAY_HEIGHT / 2; y++) display[y][0] <<= 4;
+        }
+    }
+    return true;
+}
 
-        case 0x04:
-            // 0x4XNN: Check if VX != NN, if so, skip the next instruction
-            if (emulated_system->V[emulated_system->instruction.X] != emulated_system->instruction.NN)
-                emulated_system->PC += 2;       // Skip next opcode/instruction
-            break;
+static bool emulator_execute_00FD(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00FD: Exit the interpreter (SUPER-CHIP)
+    (void)instruction;
+    emulator->emulated_system.state = QUIT;
+    return false;
+}
 
-        case 0x05:
-            // 0x5XY0: Check if VX == VY, if so, skip the next instruction
-            if (emulated_system->instruction.N != 0) break; // Wrong opcode
+static bool emulator_execute_00FE(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00FE: Low resolution, 0x00FF: high resolution (SUPER-CHIP); every plane is cleared
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    chip8->hires = instruction->NN == 0xFF;
+    memset(chip8->display, 0, sizeof chip8->display);
+    return true;
+}
 
-            if (emulated_system->V[emulated_system->instruction.X] == emulated_system->V[emulated_system->instruction.Y])
-                emulated_system->PC += 2;       // Skip next opcode/instruction
-            
-            break;
+static bool emulator_execute_00EE(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x00EE: Retorna de subrotina
+    (void)instruction;
+    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    if (emulated_system->stack_depth == 0) {
+        fprintf(stderr, "Retorno com a pilha vazia: %04X\n", emulated_system->PC - 2);
+        emulated_system->state = QUIT;
+        return false;
+    }
+    emulated_system->PC = emulated_system->stack[--emulated_system->stack_depth];
+    return false;
+}
 
-        case 0x06:
-            // 0x6XNN: Set register VX to NN
-            emulated_system->V[emulated_system->instruction.X] = emulated_system->instruction.NN;
-            break;
+static bool emulator_execute_1NNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x1NNN: Pulo para NNN
+    emulator->emulated_system.PC = instruction->NNN;
+    if (emulator->skip_idle_loops) emulator->idle_loop_length = emulator_idle_loop_length(emulator);
+    return false;
+}
 
-        case 0x07:
-            // 0x7XNN: Set register VX += NN
-            emulated_system->V[emulated_system->instruction.X] += emulated_system->instruction.NN;
-            break;
+static bool emulator_execute_2NNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x2NNN: subrotina em NNN
+    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    if (emulated_system->stack_depth >= STACK_SIZE) {
+        fprintf(stderr, "Pilha cheia: %04X\n", emulated_system->PC - 2);
+        emulated_system->state = QUIT;
+        return false;
+    }
+    emulated_system->stack[emulated_system->stack_depth++] = emulated_system->PC;
+    emulated_system->PC = instruction->NNN;
+    return false;
+}
 
-        case 0x08:
-            switch(emulated_system->instruction.N) {
-                case 0:
-                    // 0x8XY0: Set register VX = VY
-                    emulated_system->V[emulated_system->instruction.X] = emulated_system->V[emulated_system->instruction.Y];
-                    break;
-
-                case 1:
-                    // 0x8XY1: Set register VX |= VY
-                    emulated_system->V[emulated_system->instruction.X] |= emulated_system->V[emulated_system->instruction.Y];
-                    if (emulator->extension == CHIP8)
-                        emulated_system->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 2:
-                    // 0x8XY2: Set register VX &= VY
-                    emulated_system->V[emulated_system->instruction.X] &= emulated_system->V[emulated_system->instruction.Y];
-                    if (emulator->extension == CHIP8)
-                        emulated_system->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 3:
-                    // 0x8XY3: Set register VX ^= VY
-                    emulated_system->V[emulated_system->instruction.X] ^= emulated_system->V[emulated_system->instruction.Y];
-                    if (emulator->extension == CHIP8)
-                        emulated_system->V[0xF] = 0;  // Reset VF to 0
-                    break;
-
-                case 4:
-                    // 0x8XY4: Set register VX += VY, set VF to 1 if carry, 0 if not 
-                    carry = ((uint16_t)(emulated_system->V[emulated_system->instruction.X] + emulated_system->V[emulated_system->instruction.Y]) > 255);
-
-                    emulated_system->V[emulated_system->instruction.X] += emulated_system->V[emulated_system->instruction.Y];
-                    emulated_system->V[0xF] = carry; 
-                    break;
-
-                case 5: 
-                    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
-                    carry = (emulated_system->V[emulated_system->instruction.Y] <= emulated_system->V[emulated_system->instruction.X]);
-
-                    emulated_system->V[emulated_system->instruction.X] -= emulated_system->V[emulated_system->instruction.Y];
-                    emulated_system->V[0xF] = carry;
-                    break;
-
-                case 6:
-                    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
-                    if (emulator->extension == CHIP8) {
-                        carry = emulated_system->V[emulated_system->instruction.Y] & 1;    // Use VY
-                        emulated_system->V[emulated_system->instruction.X] = emulated_system->V[emulated_system->instruction.Y] >> 1; // Set VX = VY result
-                    } else {
-                        carry = emulated_system->V[emulated_system->instruction.X] & 1;    // Use VX
-                        emulated_system->V[emulated_system->instruction.X] >>= 1;          // Use VX
-                    }
-
-                    emulated_system->V[0xF] = carry;
-                    break;
-
-                case 7:
-                    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
-                    carry = (emulated_system->V[emulated_system->instruction.X] <= emulated_system->V[chip8->instruction.Y]);
-
-                    chip8->V[chip8->instruction.X] = chip8->V[chip8->instruction.Y] - chip8->V[chip8->instruction.X];
-                    chip8->V[0xF] = carry;
-                    break;
-
-                case 0xE:
-                    if (emulator->extension == CHIP8) { 
-                        carry = (chip8->V[chip8->instruction.Y] & 0x80) >> 7; // Use VY
-                        chip8->V[chip8->instruction.X] = chip8->V[chip8->instruction.Y] << 1; // Set VX = VY result
-                    } else {
-                        carry = (chip8->V[chip8->instruction.X] & 0x80) >> 7;  // VX
-                        chip8->V[chip8->instruction.X] <<= 1;                  // Use VX
-                    }
-
-                    chip8->V[0xF] = carry;
-                    break;
-
-                default:
-                    // Opcode errado ou não existe
-                    break;
-            }
-            break;
+// Skips the next instruction, whatever its length
+static inline void emulator_skip(struct Emulator *emulator) {
+    emulator->emulated_system.PC += emulator_instruction_length(emulator, emulator->emulated_system.PC);
+}
 
-        case 0x09:
-            // 0x9XY0: Check if VX != VY; Skip next instruction if so
-            if (chip8->V[chip8->instruction.X] != chip8->V[chip8->instruction.Y])
-                chip8->PC += 2;
-            break;
+static bool emulator_execute_3XNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x3XNN: Check if VX == NN, if so, skip the next instruction
+    if (emulator->emulated_system.V[instruction->X] == instruction->NN)
+        emulator_skip(emulator);
+    return false;
+}
 
-        case 0x0A:
-            // 0xANNN: Set index register I to NNN
-            chip8->I = chip8->instruction.NNN;
-            break;
+static bool emulator_execute_4XNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x4XNN: Check if VX != NN, if so, skip the next instruction
+    if (emulator->emulated_system.V[instruction->X] != instruction->NN)
+        emulator_skip(emulator);
+    return false;
+}
 
-        case 0x0B:
-            // 0xBNNN: Jump to V0 + NNN
-            chip8->PC = chip8->V[0] + chip8->instruction.NNN;
-            break;
+static bool emulator_execute_5XY0(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x5XY0: Check if VX == VY, if so, skip the next instruction
+    if (emulator->emulated_system.V[instruction->X] == emulator->emulated_system.V[instruction->Y])
+        emulator_skip(emulator);
+    return false;
+}
+
+static bool emulator_execute_5XY2(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x5XY2: Store VX to VY (in either order) in memory from I, I is unchanged (XO-CHIP)
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+    const int step = instruction->X <= instruction->Y ? 1 : -1;
+    const uint8_t count = (instruction->X <= instruction->Y ? instruction->Y - instruction->X : instruction->X - instruction->Y) + 1;
+
+    for (uint8_t i = 0; i < count; i++) chip8->ram[(chip8->I + i) & mask] = chip8->V[instruction->X + step * i];
+
+    emulator_invalidate_decoded_instructions(emulator, chip8->I, count);
+    return false;
+}
+
+static bool emulator_execute_5XY3(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x5XY3: Load VX to VY (in either order) from memory at I, I is unchanged (XO-CHIP)
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+    const int step = instruction->X <= instruction->Y ? 1 : -1;
+    const uint8_t count = (instruction->X <= instruction->Y ? instruction->Y - instruction->X : instruction->X - instruction->Y) + 1;
+
+    for (uint8_t i = 0; i < count; i++) chip8->V[instruction->X + step * i] = chip8->ram[(chip8->I + i) & mask];
+    return false;
+}
+
+static bool emulator_execute_6XNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x6XNN: Set register VX to NN
+    emulator->emulated_system.V[instruction->X] = instruction->NN;
+    return false;
+}
+
+static bool emulator_execute_7XNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x7XNN: Set register VX += NN
+    emulator->emulated_system.V[instruction->X] += instruction->NN;
+    return false;
+}
+
+static bool emulator_execute_8XY0(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY0: Set register VX = VY
+    emulator->emulated_system.V[instruction->X] = emulator->emulated_system.V[instruction->Y];
+    return false;
+}
+
+static bool emulator_execute_8XY1(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY1: Set register VX |= VY
+    emulator->emulated_system.V[instruction->X] |= emulator->emulated_system.V[instruction->Y];
+    if (emulator->extension == CHIP8)
+        emulator->emulated_system.V[0xF] = 0;  // Reset VF to 0
+    return false;
+}
+
+static bool emulator_execute_8XY2(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY2: Set register VX &= VY
+    emulator->emulated_system.V[instruction->X] &= emulator->emulated_system.V[instruction->Y];
+    if (emulator->extension == CHIP8)
+        emulator->emulated_system.V[0xF] = 0;  // Reset VF to 0
+    return false;
+}
+
+static bool emulator_execute_8XY3(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY3: Set register VX ^= VY
+    emulator->emulated_system.V[instruction->X] ^= emulator->emulated_system.V[instruction->Y];
+    if (emulator->extension == CHIP8)
+        emulator->emulated_system.V[0xF] = 0;  // Reset VF to 0
+    return false;
+}
+
+static bool emulator_execute_8XY4(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY4: Set register VX += VY, set VF to 1 if carry, 0 if not
+    uint8_t *V = emulator->emulated_system.V;
+    const bool carry = ((uint16_t)(V[instruction->X] + V[instruction->Y]) > 255);
+
+    V[instruction->X] += V[instruction->Y];
+    V[0xF] = carry;
+    return false;
+}
+
+static bool emulator_execute_8XY5(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY5: Set register VX -= VY, set VF to 1 if there is not a borrow (result is positive/0)
+    uint8_t *V = emulator->emulated_system.V;
+    const bool carry = (V[instruction->Y] <= V[instruction->X]);
+
+    V[instruction->X] -= V[instruction->Y];
+    V[0xF] = carry;
+    return false;
+}
+
+static bool emulator_execute_8XY6(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY6: Set register VX >>= 1, store shifted off bit in VF
+    uint8_t *V = emulator->emulated_system.V;
+    bool carry;
+
+    if (emulator->extension != SUPERCHIP) {
+        carry = V[instruction->Y] & 1;    // Use VY
+        V[instruction->X] = V[instruction->Y] >> 1; // Set VX = VY result
+    } else {
+        carry = V[instruction->X] & 1;    // Use VX
+        V[instruction->X] >>= 1;          // Use VX
+    }
+
+    V[0xF] = carry;
+    return false;
+}
+
+static bool emulator_execute_8XY7(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XY7: Set register VX = VY - VX, set VF to 1 if there is not a borrow (result is positive/0)
+    uint8_t *V = emulator->emulated_system.V;
+    const bool carry = (V[instruction->X] <= V[instruction->Y]);
+
+    V[instruction->X] = V[instruction->Y] - V[instruction->X];
+    V[0xF] = carry;
+    return false;
+}
+
+static bool emulator_execute_8XYE(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x8XYE: Set register VX <<= 1, store shifted off bit in VF
+    uint8_t *V = emulator->emulated_system.V;
+    bool carry;
+
+    if (emulator->extension != SUPERCHIP) {
+        carry = (V[instruction->Y] & 0x80) >> 7; // Use VY
+        V[instruction->X] = V[instruction->Y] << 1; // Set VX = VY result
+    } else {
+        carry = (V[instruction->X] & 0x80) >> 7;  // VX
+        V[instruction->X] <<= 1;                  // Use VX
+    }
+
+    V[0xF] = carry;
+    return false;
+}
+
+static bool emulator_execute_9XY0(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0x9XY0: Check if VX != VY; Skip next instruction if so
+    if (emulator->emulated_system.V[instruction->X] != emulator->emulated_system.V[instruction->Y])
+        emulator_skip(emulator);
+    return false;
+}
+
+static bool emulator_execute_ANNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xANNN: Set index register I to NNN
+    emulator->emulated_system.I = instruction->NNN;
+    return false;
+}
+
+static bool emulator_execute_BNNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xBNNN: Jump to V0 + NNN (SUPER-CHIP: BXNN, VX + XNN)
+    const uint8_t offset = emulator->emulated_system.V[emulator->extension == SUPERCHIP ? instruction->X : 0];
+    emulator->emulated_system.PC = offset + instruction->NNN;
+    return false;
+}
+
+static bool emulator_execute_CXNN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xCXNN: VX = random byte & NN (bitwise AND)
+    emulator->emulated_system.V[instruction->X] = emulated_random(&emulator->emulated_system) & instruction->NN;
+    return false;
+}
+
+// XORs one sprite row (left-aligned in bits) into a display row of words words at column x; returns the pixels
+// turned off. Bits shifted past the right edge of the display fall off the row (clipping), or wrap to its left.
+static inline uint64_t emulator_draw_row(uint64_t *row, uint64_t bits, uint32_t x, uint32_t words, bool wrap) {
+    const uint32_t word = x / 64, shift = x % 64;
+    const uint64_t left = bits >> shift;
+    uint64_t collision = row[word] & left;
+
+    row[word] ^= left;
+    if (shift != 0 && (wrap || word + 1 < words)) {
+        const uint32_t next = word + 1 < words ? word + 1 : 0;
+        const uint64_t right = bits << (64 - shift);
+        collision |= row[next] & right;
+        row[next] ^= right;
+    }
+    return collision;
+}
+
+static bool emulator_execute_DXYN(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+    //   Screen pixels are XOR'd with sprite bits,
+    //   VF (Carry flag) is set if any screen pixels are set off; This is useful
+    //   for collision detection or other reasons.
+    //   SUPER-CHIP: DXY0 draws a 16x16 sprite (two bytes per row), and in hi-res VF counts the rows
+    //   that collided or were clipped at the bottom.
+    //   XO-CHIP: each selected plane gets the next sprite in memory, and sprites wrap around the edges.
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+    const bool wrap = emulator->extension == XOCHIP;
+    const uint32_t width = emulated_display_width(chip8), height = emulated_display_height(chip8);
+    const bool large = instruction->N == 0 && emulator->extension != CHIP8;
+    const uint32_t sprite_rows = large ? 16 : instruction->N;
+    const uint32_t sprite_size = large ? 32 : instruction->N;
+    const uint32_t X_coord = chip8->V[instruction->X] % width;
+    const uint32_t Y_coord = chip8->V[instruction->Y] % height;
+    const uint32_t rows = !wrap && Y_coord + sprite_rows > height ? height - Y_coord : sprite_rows;
+    uint32_t address = chip8->I;
+    uint64_t collision = 0;
+    uint8_t collided_rows = 0;
+
+    // One or two word operations per sprite row
+    for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++) {
+        if (!emulator_plane_selected(chip8, plane)) continue;
+
+        for (uint32_t i = 0; i < rows; i++) {
+            uint64_t bits;
+            if (large) bits = (uint64_t)chip8->ram[(address + 2 * i) & mask] << 56
+                              | (uint64_t)chip8->ram[(address + 2 * i + 1) & mask] << 48;
+            else bits = (uint64_t)chip8->ram[(address + i) & mask] << 56;
+
+            uint64_t *row = chip8->display[plane][(Y_coord + i) % height];
+            const uint64_t row_collision = emulator_draw_row(row, bits, X_coord, width / 64, wrap);
+            collision |= row_collision;
+            collided_rows += row_collision != 0;
+        }
+        address += sprite_size;
+    }
+
+    if (chip8->hires && emulator->extension == SUPERCHIP) chip8->V[0xF] = collided_rows + (sprite_rows - rows);
+    else chip8->V[0xF] = collision != 0;
+    return true; // atualiza tela no próximo tick 60hz
+}
+
+// Ends the latency measurement of a key the first time an instruction sees it pressed
+static void emulator_observe_key(struct Emulator *emulator, uint8_t key) {
+    struct EmulatorInput *input = emulator->input;
+    const uint64_t pressed_ns = atomic_exchange_explicit(&input->pressed_ns[key], 0, memory_order_relaxed);
+    if (pressed_ns == 0) return;
+
+    const uint64_t now = emulator_headless_now_ns();
+    const uint64_t latency = now > pressed_ns ? now - pressed_ns : 0;
+    input->latency_samples++;
+    input->latency_total_ns += latency;
+    if (latency > input->latency_max_ns) input->latency_max_ns = latency;
+}
+
+static inline bool emulator_key_pressed(struct Emulator *emulator, uint8_t key) {
+    const bool pressed = emulator->emulated_system.keypad[key];
+    if (pressed && emulator->input && emulator->input->measure_latency && !emulator->movie) emulator_observe_key(emulator, key);
+    return pressed;
+}
+
+static bool emulator_execute_EX9E(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xEX9E: Skip next instruction if key in VX is pressed
+    emulator_sample_input(emulator);
+    if (emulator_key_pressed(emulator, emulator->emulated_system.V[instruction->X] & 0x0F))
+        emulator_skip(emulator);
+    return false;
+}
+
+static bool emulator_execute_EXA1(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xEXA1: Skip next instruction if key in VX is not pressed
+    emulator_sample_input(emulator);
+    if (!emulator_key_pressed(emulator, emulator->emulated_system.V[instruction->X] & 0x0F))
+        emulator_skip(emulator);
+    return false;
+}
+
+static bool emulator_execute_F000(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xF000 NNNN: Set I to the 16-bit address in the next two bytes, which are skipped (XO-CHIP)
+    (void)instruction;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    chip8->I = chip8->ram[chip8->PC] << 8 | chip8->ram[(chip8->PC + 1) & RAM_MASK];
+    chip8->PC += 2;
+    return false;
+}
+
+static bool emulator_execute_FN01(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFN01: Select the planes drawn, cleared and scrolled, bitmask N (XO-CHIP)
+    emulator->emulated_system.planes = instruction->X & 0x3;
+    return false;
+}
 
-        case 0x0C:
-            // 0xCXNN: VX = rand() % 256 & NN (bitwise AND)
-            chip8->V[chip8->instruction.X] = (rand() % 256) & chip8->instruction.NN;
+static bool emulator_execute_F002(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xF002: Load the 16-byte audio pattern from I (XO-CHIP)
+    (void)instruction;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+
+    for (uint32_t i = 0; i < AUDIO_PATTERN_SIZE; i++) chip8->audio_pattern[i] = chip8->ram[(chip8->I + i) & mask];
+    chip8->has_audio_pattern = true;
+    return false;
+}
+
+static bool emulator_execute_FX3A(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX3A: Set the audio pattern pitch to VX (XO-CHIP)
+    emulator->emulated_system.pitch = emulator->emulated_system.V[instruction->X];
+    return false;
+}
+
+static bool emulator_execute_FX07(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX07: VX = delay timer
+    emulator->emulated_system.V[instruction->X] = emulator->emulated_system.delay_timer;
+    return false;
+}
+
+static bool emulator_execute_FX0A(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX0A: VX = get_key(); guarda em VX
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+
+    emulator_sample_input(emulator);
+    for (uint8_t i = 0; chip8->awaited_key == 0xFF && i < sizeof chip8->keypad; i++)
+        if (emulator_key_pressed(emulator, i)) {
+            chip8->awaited_key = i;
             break;
+        }
+
+    if (chip8->awaited_key == 0xFF) chip8->PC -= 2;
+    else {
+        // A key has been pressed, also wait until it is released to set the key in VX
+        if (chip8->keypad[chip8->awaited_key])     // "Busy loop" CHIP8 emulation until key is released
+            chip8->PC -= 2;
+        else {
+            chip8->V[instruction->X] = chip8->awaited_key;     // VX = key
+            chip8->awaited_key = 0xFF;                        // Reset key não encontrada
+            return false;
+        }
+    }
+
+    // Still waiting: running it again changes nothing until the keypad does
+    if (emulator->skip_idle_loops) emulator->idle_loop_length = 1;
+    return false;
+}
+
+static bool emulator_execute_FX15(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX15: delay timer = VX
+    emulator->emulated_system.delay_timer = emulator->emulated_system.V[instruction->X];
+    return false;
+}
+
+static bool emulator_execute_FX18(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX18: sound timer = VX
+    emulator->emulated_system.sound_timer = emulator->emulated_system.V[instruction->X];
+    return false;
+}
+
+static bool emulator_execute_FX1E(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX1E: I += VX; poe VX para reg I.
+    emulator->emulated_system.I += emulator->emulated_system.V[instruction->X];
+    return false;
+}
+
+static bool emulator_execute_FX29(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
+    emulator->emulated_system.I = emulator->emulated_system.V[instruction->X] * 5;
+    return false;
+}
+
+static bool emulator_execute_FX30(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX30: Set register I to the large (8x10) sprite of the digit in VX (SUPER-CHIP)
+    emulator->emulated_system.I = emulated_system_large_font_address + (emulator->emulated_system.V[instruction->X] & 0x0F) * 10;
+    return false;
+}
 
-        case 0x0D: {
-            // 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-            //   Screen pixels are XOR'd with sprite bits, 
-            //   VF (Carry flag) is set if any screen pixels are set off; This is useful
-            //   for collision detection or other reasons.
-            uint8_t X_coord = chip8->V[chip8->instruction.X] % emulator->user_interface.desired_window_width;
-            uint8_t Y_coord = chip8->V[chip8->instruction.Y] % emulator->user_interface.desired_window_height;
-            const uint8_t orig_X = X_coord; // Original X value
+static bool emulator_execute_FX33(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX33: Store BCD representation of VX at I, I+1 and I+2
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+    uint8_t bcd = chip8->V[instruction->X];
 
-            chip8->V[0xF] = 0;  // Initialize carry flag to 0
+    chip8->ram[(chip8->I + 2) & mask] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[(chip8->I + 1) & mask] = bcd % 10;
+    bcd /= 10;
+    chip8->ram[chip8->I & mask] = bcd;
 
-            // Loop over all N rows of the sprite
-            for (uint8_t i = 0; i < chip8->instruction.N; i++) {
-                // Get next byte/row of sprite data
-                const uint8_t sprite_data = chip8->ram[chip8->I + i];
-                X_coord = orig_X;   // Reset X for next row to draw
+    emulator_invalidate_decoded_instructions(emulator, chip8->I, 3);
+    return false;
+}
 
-                for (int8_t j = 7; j >= 0; j--) {
-                    // set carry flag
-                    bool *pixel = &chip8->display[Y_coord * emulator->user_interface.desired_window_width + X_coord]; 
-                    const bool sprite_bit = (sprite_data & (1 << j));
+static bool emulator_execute_FX55(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
+    const uint16_t start = chip8->I;
+
+    for (uint8_t i = 0; i <= instruction->X; i++)  {
+        if (emulator->extension != SUPERCHIP)
+            chip8->ram[chip8->I++ & mask] = chip8->V[i]; // Incremento de reg I
+        else
+            chip8->ram[(chip8->I + i) & mask] = chip8->V[i];
+    }
 
-                    if (sprite_bit && *pixel) {
-                        chip8->V[0xF] = 1;  
-                    }
+    emulator_invalidate_decoded_instructions(emulator, start, instruction->X + 1);
+    return false;
+}
 
-                    // XOR display pixel
-                    *pixel ^= sprite_bit;
+static bool emulator_execute_FX65(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
+    struct EmulatedSystem *chip8 = &emulator->emulated_system;
+    const uint32_t mask = emulator_ram_size(emulator) - 1;
 
-                    // Para de desenhar se bater no canto da tela
-                    if (++X_coord >= emulator->user_interface.desired_window_width) break;
-                }
+    for (uint8_t i = 0; i <= instruction->X; i++) {
+        if (emulator->extension != SUPERCHIP)
+            chip8->V[i] = chip8->ram[chip8->I++ & mask]; // Incremento de reg I
+        else
+            chip8->V[i] = chip8->ram[(chip8->I + i) & mask];
+    }
+    return false;
+}
 
-                if (++Y_coord >= emulator->user_interface.desired_window_height) break;
+static bool emulator_execute_FX75(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX75: Store V0-VX in the RPL user flags (SUPER-CHIP)
+    memcpy(emulator->emulated_system.rpl, emulator->emulated_system.V, instruction->X + 1);
+    return false;
+}
+
+static bool emulator_execute_FX85(struct Emulator *emulator, const struct Instruction *instruction) {
+    // 0xFX85: Load V0-VX from the RPL user flags (SUPER-CHIP)
+    memcpy(emulator->emulated_system.V, emulator->emulated_system.rpl, instruction->X + 1);
+    return false;
+}
+
+// Fills a decoded instruction (handler + operands) from the opcode stored at address
+static void emulator_decode_instruction(struct Emulator *emulator, uint16_t address, struct DecodedInstruction *decoded) {
+    const uint8_t *ram = emulator->emulated_system.ram;
+    struct Instruction *instruction = &decoded->instruction;
+
+    instruction->opcode = (ram[address] << 8) | ram[address + 1];
+    instruction->NNN = instruction->opcode & 0x0FFF;
+    instruction->NN = instruction->opcode & 0x0FF;
+    instruction->N = instruction->opcode & 0x0F;
+    instruction->X = (instruction->opcode >> 8) & 0x0F;
+    instruction->Y = (instruction->opcode >> 4) & 0x0F;
+
+    InstructionHandler handler = emulator_execute_invalid;
+    const bool superchip = emulator->extension != CHIP8; // XO-CHIP includes the SUPER-CHIP instructions
+    const bool xochip = emulator->extension == XOCHIP;
+
+    switch ((instruction->opcode >> 12) & 0x0F) {
+        case 0x00:
+            if (instruction->NN == 0xE0) handler = emulator_execute_00E0;
+            else if (instruction->NN == 0xEE) handler = emulator_execute_00EE;
+            else if (!superchip || instruction->X != 0) break;
+            else if (instruction->Y == 0xC || (instruction->Y == 0xD && xochip)) handler = emulator_execute_00CN;
+            else if (instruction->NN == 0xFB) handler = emulator_execute_00FB;
+            else if (instruction->NN == 0xFC) handler = emulator_execute_00FC;
+            else if (instruction->NN == 0xFD) handler = emulator_execute_00FD;
+            else if (instruction->NN == 0xFE || instruction->NN == 0xFF) handler = emulator_execute_00FE;
+            break;
+
+        case 0x01: handler = emulator_execute_1NNN; break;
+        case 0x02: handler = emulator_execute_2NNN; break;
+        case 0x03: handler = emulator_execute_3XNN; break;
+        case 0x04: handler = emulator_execute_4XNN; break;
+        case 0x05:
+            if (instruction->N == 0) handler = emulator_execute_5XY0;
+            else if (instruction->N == 2 && xochip) handler = emulator_execute_5XY2;
+            else if (instruction->N == 3 && xochip) handler = emulator_execute_5XY3;
+            break;
+
+        case 0x06: handler = emulator_execute_6XNN; break;
+        case 0x07: handler = emulator_execute_7XNN; break;
+
+        case 0x08:
+            switch (instruction->N) {
+                case 0x0: handler = emulator_execute_8XY0; break;
+                case 0x1: handler = emulator_execute_8XY1; break;
+                case 0x2: handler = emulator_execute_8XY2; break;
+                case 0x3: handler = emulator_execute_8XY3; break;
+                case 0x4: handler = emulator_execute_8XY4; break;
+                case 0x5: handler = emulator_execute_8XY5; break;
+                case 0x6: handler = emulator_execute_8XY6; break;
+                case 0x7: handler = emulator_execute_8XY7; break;
+                case 0xE: handler = emulator_execute_8XYE; break;
+                default: break; // Opcode errado ou não existe
             }
-            should_draw = true; // atualiza tela no próximo tick 60hz
             break;
-        }
+
+        case 0x09: handler = emulator_execute_9XY0; break;
+        case 0x0A: handler = emulator_execute_ANNN; break;
+        case 0x0B: handler = emulator_execute_BNNN; break;
+        case 0x0C: handler = emulator_execute_CXNN; break;
+        case 0x0D: handler = emulator_execute_DXYN; break;
 
         case 0x0E:
-            if (chip8->instruction.NN == 0x9E) {
-                // 0xEX9E: Skip next instruction if key in VX is pressed
-                if (chip8->keypad[chip8->V[chip8->instruction.X]])
-                    chip8->PC += 2;
-
-            } else if (chip8->instruction.NN == 0xA1) {
-                // 0xEX9E: Skip next instruction if key in VX is not pressed
-                if (!chip8->keypad[chip8->V[chip8->instruction.X]])
-                    chip8->PC += 2;
-            }
+            if (instruction->NN == 0x9E) handler = emulator_execute_EX9E;
+            else if (instruction->NN == 0xA1) handler = emulator_execute_EXA1;
             break;
 
         case 0x0F:
-            switch (chip8->instruction.NN) {
-                case 0x0A: {
-                    // 0xFX0A: VX = get_key(); guarda em VX
-                    static bool any_key_pressed = false;
-                    static uint8_t key = 0xFF;
-
-                    for (uint8_t i = 0; key == 0xFF && i < sizeof chip8->keypad; i++) 
-                        if (chip8->keypad[i]) {
-                            key = i;   
-                            any_key_pressed = true;
-                            break;
-                        }
-
-                    
-                    if (!any_key_pressed) chip8->PC -= 2; 
-                    else {
-                        // A key has been pressed, also wait until it is released to set the key in VX
-                        if (chip8->keypad[key])     // "Busy loop" CHIP8 emulation until key is released
-                            chip8->PC -= 2;
-                        else {
-                            chip8->V[chip8->instruction.X] = key;     // VX = key 
-                            key = 0xFF;                        // Reset key não encontrada
-                            any_key_pressed = false;
-                        }
-                    }
-                    break;
-                }
-
-                case 0x1E:
-                    // 0xFX1E: I += VX; poe VX para reg I.
-                    chip8->I += chip8->V[chip8->instruction.X];
-                    break;
-
-                case 0x07:
-                    // 0xFX07: VX = delay timer
-                    chip8->V[chip8->instruction.X] = chip8->delay_timer;
-                    break;
-
-                case 0x15:
-                    // 0xFX15: delay timer = VX 
-                    chip8->delay_timer = chip8->V[chip8->instruction.X];
-                    break;
-
-                case 0x18:
-                    // 0xFX18: sound timer = VX 
-                    chip8->sound_timer = chip8->V[chip8->instruction.X];
-                    break;
-
-                case 0x29:
-                    // 0xFX29: Set register I to sprite location in memory for character in VX (0x0-0xF)
-                    chip8->I = chip8->V[chip8->instruction.X] * 5;
-                    break;
-
-                case 0x33: {
-                    uint8_t bcd = chip8->V[chip8->instruction.X]; 
-                    chip8->ram[chip8->I+2] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I+1] = bcd % 10;
-                    bcd /= 10;
-                    chip8->ram[chip8->I] = bcd;
-                    break;
-                }
-
-                case 0x55:
-                    // 0xFX55: Register dump V0-VX inclusive to memory offset from I;
-                    for (uint8_t i = 0; i <= chip8->instruction.X; i++)  {
-                        if (emulator->extension == CHIP8) 
-                            chip8->ram[chip8->I++] = chip8->V[i]; // Incremento de reg I
-                        else
-                            chip8->ram[chip8->I + i] = chip8->V[i]; 
-                    }
-                    break;
-
-                case 0x65:
-                    // 0xFX65: Register load V0-VX inclusive from memory offset from I;
-                    for (uint8_t i = 0; i <= chip8->instruction.X; i++) {
-                        if (emulator->extension == CHIP8) 
-                            chip8->V[i] = chip8->ram[chip8->I++]; // Incremento de reg I
-                        else
-                            chip8->V[i] = chip8->ram[chip8->I + i];
-                    }
-                    break;
-
-                default:
-                    break;
+            switch (instruction->NN) {
+                case 0x00: if (xochip && instruction->X == 0) handler = emulator_execute_F000; break;
+                case 0x01: if (xochip) handler = emulator_execute_FN01; break;
+                case 0x02: if (xochip && instruction->X == 0) handler = emulator_execute_F002; break;
+                case 0x07: handler = emulator_execute_FX07; break;
+                case 0x0A: handler = emulator_execute_FX0A; break;
+                case 0x15: handler = emulator_execute_FX15; break;
+                case 0x18: handler = emulator_execute_FX18; break;
+                case 0x1E: handler = emulator_execute_FX1E; break;
+                case 0x29: handler = emulator_execute_FX29; break;
+                case 0x30: if (superchip) handler = emulator_execute_FX30; break;
+                case 0x33: handler = emulator_execute_FX33; break;
+                case 0x3A: if (xochip) handler = emulator_execute_FX3A; break;
+                case 0x55: handler = emulator_execute_FX55; break;
+                case 0x65: handler = emulator_execute_FX65; break;
+                case 0x75: if (superchip) handler = emulator_execute_FX75; break;
+                case 0x85: if (superchip) handler = emulator_execute_FX85; break;
+                default: break;
             }
             break;
-            
+
         default:
-            break;  // Opcode inválido
+            break;
     }
-    return should_draw;
+
+    decoded->handler = handler;
+    decoded->fused_length = 0;
+}
+
+// Superinstructions. Each one runs, with a single dispatch, a sequence the decoded instruction starts (the PC
+// already past it); the instructions after it are decoded in the following entries of the cache.
+
+static bool emulator_is_skip(InstructionHandler handler) {
+    return handler == emulator_execute_3XNN || handler == emulator_execute_4XNN || handler == emulator_execute_5XY0 ||
+           handler == emulator_execute_9XY0 || handler == emulator_execute_EX9E || handler == emulator_execute_EXA1;
+}
+
+static uint32_t emulator_execute_skip_1NNN(struct Emulator *emulator, const struct DecodedInstruction *decoded) {
+    // skip; 0x1NNN: loop condition, the jump runs only when the skip is not taken
+    const uint16_t next = emulator->emulated_system.PC;
+
+    decoded[0].handler(emulator, &decoded[0].instruction);
+    if (emulator->emulated_system.PC != next) return 1;
+
+    emulator_execute_1NNN(emulator, &decoded[2].instruction);
+    return 2;
+}
+
+static uint32_t emulator_execute_7XNN_skip_1NNN(struct Emulator *emulator, const struct DecodedInstruction *decoded) {
+    // 0x7XNN; skip; 0x1NNN: loop counter
+    emulator->emulated_system.V[decoded[0].instruction.X] += decoded[0].instruction.NN;
+    emulator->emulated_system.PC += 2;
+    return 1 + emulator_execute_skip_1NNN(emulator, &decoded[2]);
+}
+
+static uint32_t emulator_execute_6XNN_6XNN_DXYN(struct Emulator *emulator, const struct DecodedInstruction *decoded) {
+    // 0x6XNN; 0x6YNN; 0xDXYN: sprite position, then draw
+    emulator->emulated_system.V[decoded[0].instruction.X] = decoded[0].instruction.NN;
+    emulator->emulated_system.V[decoded[2].instruction.X] = decoded[2].instruction.NN;
+    emulator->emulated_system.PC += 4;
+    emulator_execute_DXYN(emulator, &decoded[4].instruction);
+    return 3;
+}
+
+static uint32_t emulator_execute_ANNN_FX1E(struct Emulator *emulator, const struct DecodedInstruction *decoded) {
+    // 0xANNN; 0xFX1E: table indexing
+    emulator->emulated_system.I = decoded[0].instruction.NNN;
+    emulator->emulated_system.I += emulator->emulated_system.V[decoded[2].instruction.X];
+    emulator->emulated_system.PC += 2;
+    return 2;
+}
+
+// Looks for a superinstruction starting at the (decoded) instruction at address
+static void emulator_fuse_instructions(struct Emulator *emulator, uint16_t address, struct DecodedInstruction *decoded) {
+    decoded->fused_length = 1;
+    if ((uint32_t)address + 2 * (FUSED_MAX_INSTRUCTIONS - 1) >= emulator_ram_size(emulator) - 3) return;
+
+    for (uint32_t i = 1; i < FUSED_MAX_INSTRUCTIONS; i++)
+        if (!decoded[2 * i].handler) emulator_decode_instruction(emulator, address + 2 * i, &decoded[2 * i]);
+
+    const InstructionHandler first = decoded[0].handler, second = decoded[2].handler, third = decoded[4].handler;
+
+    if (emulator_is_skip(first) && second == emulator_execute_1NNN) {
+        decoded->fused = emulator_execute_skip_1NNN;
+        decoded->fused_length = 2;
+    }
+    else if (first == emulator_execute_7XNN && emulator_is_skip(second) && third == emulator_execute_1NNN) {
+        decoded->fused = emulator_execute_7XNN_skip_1NNN;
+        decoded->fused_length = 3;
+    }
+    else if (first == emulator_execute_6XNN && second == emulator_execute_6XNN && third == emulator_execute_DXYN) {
+        decoded->fused = emulator_execute_6XNN_6XNN_DXYN;
+        decoded->fused_length = 3;
+    }
+    else if (first == emulator_execute_ANNN && second == emulator_execute_FX1E) {
+        decoded->fused = emulator_execute_ANNN_FX1E;
+        decoded->fused_length = 2;
+    }
+}
+
+void emulator_invalidate_decoded_instructions(struct Emulator *emulator, uint16_t address, uint16_t length) {
+    const uint32_t ram_size = emulator_ram_size(emulator);
+    const uint32_t start = address & (ram_size - 1);
+
+    // Writes through I wrap around the end of the machine's memory
+    if (start + length > ram_size) {
+        emulator_invalidate_decoded_instructions(emulator, 0, start + length - ram_size);
+        length = ram_size - start;
+    }
+
+    // An instruction starting one byte before the written range also contains a written byte
+    for (uint32_t i = 0; i <= length; i++)
+        emulator->decoded_instructions[(start - 1 + i) & (ram_size - 1)].handler = NULL;
+
+    // and a superinstruction starting up to FUSED_MAX_INSTRUCTIONS - 1 instructions before that one may cover it
+    for (uint32_t i = 2; i < 2 * FUSED_MAX_INSTRUCTIONS; i++)
+        emulator->decoded_instructions[(start - i) & (ram_size - 1)].fused_length = 0;
+
+    if (emulator->jit) emulator_jit_invalidate(emulator->jit, start, length);
+}
+
+// Fetch, decode (cached) and execute. Inlined into both entry points below, so the profiling and tracing
+// code only exists in the instrumented one.
+static inline __attribute__((always_inline)) bool emulator_step(struct Emulator *emulator, struct Profile *profile, struct Trace *trace) {
+    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    const uint16_t PC = emulated_system->PC;
+
+    if (PC >= emulator_ram_size(emulator) - 3) {
+        emulated_system->PC += 2;
+        fprintf(stderr, "PC fora do limite: %04X\n", emulated_system->PC);
+        emulated_system->state = QUIT;
+        return false;
+    }
+
+    // Decode only the first time this address is executed (or after it was overwritten)
+    struct DecodedInstruction *decoded = &emulator->decoded_instructions[PC];
+    if (!decoded->handler) emulator_decode_instruction(emulator, PC, decoded);
+
+    emulated_system->PC += 2;
+
+    if (!profile && !trace) return decoded->handler(emulator, &decoded->instruction);
+
+    const uint16_t opcode = decoded->instruction.opcode;
+    bool drawn;
+
+    if (profile) emulator_profile_count(profile, PC, opcode);
+
+    if (profile && ((opcode & 0xF000) == 0xD000 || opcode == 0x00E0)) {
+        const uint64_t start = emulator_headless_now_ns();
+        drawn = decoded->handler(emulator, &decoded->instruction);
+        profile->draw_ns += emulator_headless_now_ns() - start;
+        profile->draws++;
+    }
+    else {
+        drawn = decoded->handler(emulator, &decoded->instruction);
+    }
+
+    if (trace) emulator_trace_instruction(trace, PC, opcode, emulated_system);
+    return drawn;
+}
+
+bool emulator_emulate_instruction(struct Emulator *emulator) {
+    return emulator_step(emulator, NULL, NULL);
+}
+
+bool emulator_emulate_instruction_reference(struct Emulator *emulator) {
+    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    struct DecodedInstruction decoded;
+
+    if (emulated_system->PC >= emulator_ram_size(emulator) - 3) return emulator_step(emulator, NULL, NULL); // quits
+
+    emulator_decode_instruction(emulator, emulated_system->PC, &decoded);
+    emulated_system->PC += 2;
+    return decoded.handler(emulator, &decoded.instruction);
+}
+
+static bool emulator_emulate_instruction_instrumented(struct Emulator *emulator) {
+    return emulator_step(emulator, emulator->profile, emulator->trace);
+}
+
+// Interpreter loop: runs the superinstruction starting at PC when it fits in the remaining instructions, one
+// instruction otherwise; returns how many ran
+static uint32_t emulator_emulate_fused(struct Emulator *emulator, uint64_t remaining_instructions) {
+    struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    const uint16_t PC = emulated_system->PC;
+
+    if (PC >= emulator_ram_size(emulator) - 3) {
+        emulator_step(emulator, NULL, NULL); // quits
+        return 1;
+    }
+
+    struct DecodedInstruction *decoded = &emulator->decoded_instructions[PC];
+    if (!decoded->handler) emulator_decode_instruction(emulator, PC, decoded);
+    emulated_system->PC += 2;
+
+    if (decoded->fused_length != 1) {
+        if (!decoded->fused_length) emulator_fuse_instructions(emulator, PC, decoded);
+        if (decoded->fused_length > 1 && decoded->fused_length <= remaining_instructions) return decoded->fused(emulator, decoded);
+    }
+
+    decoded->handler(emulator, &decoded->instruction);
+    return 1;
+}
+
+bool emulator_save_state(struct Emulator *emulator, const char *filename) {
+    return emulated_save_state(&emulator->emulated_system, emulator_ram_size(emulator), filename);
+}
+
+// Called when the whole RAM may have changed
+static void emulator_flush_decoded_instructions(struct Emulator *emulator) {
+    memset(emulator->decoded_instructions, 0, sizeof emulator->decoded_instructions);
+    if (emulator->jit) emulator_jit_flush(emulator->jit);
+}
+
+bool emulator_load_state(struct Emulator *emulator, const char *filename) {
+    if (emulator->movie) {
+        fprintf(stderr, "Save states can not be loaded while a movie is recorded or played\n");
+        return false;
+    }
+    if (!emulated_load_state(&emulator->emulated_system, emulator_ram_size(emulator), filename)) return false;
+
+    emulator_flush_decoded_instructions(emulator);
+    return true;
+}
+
+void emulator_restore_system(struct Emulator *emulator, const struct EmulatedSystem *emulated_system) {
+    emulator->emulated_system = *emulated_system;
+    emulator_flush_decoded_instructions(emulator);
+}
+
+bool emulator_rewind(struct Emulator *emulator) {
+    if (!emulator->rewind || emulator->movie) return false;
+
+    // Most frames do not write RAM, so the caches usually survive
+    uint8_t ram[RAM_SIZE];
+    memcpy(ram, emulator->emulated_system.ram, RAM_SIZE);
+    if (!emulator_rewind_restore(emulator->rewind, &emulator->emulated_system)) return false;
+
+    if (memcmp(ram, emulator->emulated_system.ram, RAM_SIZE) != 0) emulator_flush_decoded_instructions(emulator);
+    emulator->should_play_sound = false;
+    return true;
 }
 
 void emulator_destroy(struct Emulator *emulator) {
-    emulator_user_interface_destroy(&emulator->user_interface);
+    emulator_jit_destroy(emulator->jit);
+    emulator->jit = NULL;
+    emulator_rewind_destroy(emulator->rewind);
+    emulator->rewind = NULL;
+    emulator_movie_close(emulator->movie);
+    emulator->movie = NULL;
+    emulator_beeper_destroy(emulator->beeper);
+    emulator->beeper = NULL;
+    emulator_capture_close(emulator->capture);
+    emulator->capture = NULL;
+    emulator_profile_destroy(emulator->profile);
+    emulator->profile = NULL;
+    if (!emulator_trace_close(emulator->trace)) fprintf(stderr, "Could not save the trace\n");
+    emulator->trace = NULL;
 }
\ No newline at end of file
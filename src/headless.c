@@ -0,0 +1,44 @@
+// Headless runner
+
+#include "headless.h"
+
+#include <stdio.h>
+#include <time.h> // clock_gettime()
+
+uint64_t emulator_headless_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+uint64_t emulator_headless_run_frames(struct Emulator *emulator, uint64_t max_frames, uint64_t max_instructions) {
+    const uint64_t start_instructions = emulator->instructions_executed;
+    const uint64_t start_frames = emulator->frames_executed;
+    const uint64_t start = emulator_headless_now_ns();
+
+    // No pacing: frames are emulated back to back, timers still step once per frame
+    while (emulator->emulated_system.state != QUIT) {
+        if (max_frames != 0 && emulator->frames_executed - start_frames >= max_frames) break;
+        if (max_instructions != 0 && emulator->instructions_executed - start_instructions >= max_instructions) break;
+        emulator_update(emulator);
+    }
+
+    return emulator_headless_now_ns() - start;
+}
+
+void emulator_headless_run(struct Emulator *emulator, uint64_t max_frames) {
+    const uint64_t start_instructions = emulator->instructions_executed;
+    const uint64_t start_skipped = emulator->instructions_skipped;
+    const uint64_t start_frames = emulator->frames_executed;
+
+    const uint64_t elapsed = emulator_headless_run_frames(emulator, max_frames, 0);
+    const uint64_t instructions = emulator->instructions_executed - start_instructions;
+    const double seconds = elapsed / 1e9;
+
+    printf("frames: %llu\n", (long long unsigned)(emulator->frames_executed - start_frames));
+    printf("instructions: %llu\n", (long long unsigned)instructions);
+    printf("idle instructions skipped: %llu\n", (long long unsigned)(emulator->instructions_skipped - start_skipped));
+    printf("elapsed: %.6f s\n", seconds);
+    printf("instructions per second: %.0f\n", seconds > 0 ? instructions / seconds : 0.0);
+    printf("display hash: %016llx\n", (long long unsigned)emulated_display_hash(&emulator->emulated_system));
+}
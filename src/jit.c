@@ -0,0 +1,467 @@
+// Dynamic recompiler (x86-64)
+//
+// A block is a run of register-only instructions starting at some PC. It ends at a control flow
+// instruction (1NNN, 2NNN, 00EE, BNNN, skips), which is compiled as the last instruction of the block, or
+// right before an instruction that is left to the interpreter (DXYN, FX0A, RAM writes, ...).
+// Compiled code receives struct EmulatedSystem * in rdi, only touches rax/rcx and always stores the next PC.
+// Blocks never write RAM, so the interpreter's writes are the only ones that need to invalidate code.
+
+#include "jit.h"
+
+#include <stddef.h> // offsetof()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (1024 * 1024)
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_MAX_BLOCK_BYTES 1024 // worst case machine code for one block, checked before compiling
+#define JIT_PAGE_SIZE 256
+#define JIT_COMPILE_THRESHOLD 16 // interpreted executions before a block is compiled
+
+typedef void (*JitCode)(struct EmulatedSystem *emulated_system);
+
+struct JitBlock {
+  JitCode code;
+  uint16_t length; // instructions
+  uint16_t executions; // while uncompiled, so code that keeps being rewritten stays interpreted
+  int8_t stack_change; // +1 when the block ends with a call (2NNN), -1 with a return (00EE)
+  enum {
+    JIT_BLOCK_UNCOMPILED,
+    JIT_BLOCK_COMPILED,
+    JIT_BLOCK_INTERPRETED, // first instruction can not be compiled
+  } status;
+};
+
+struct Jit {
+  uint8_t *code; // code buffer: executable, and writable instead only while a block is being emitted (W^X)
+  size_t code_used;
+  struct JitBlock blocks[RAM_SIZE]; // indexed by the address of the first instruction
+  bool page_has_code[RAM_SIZE / JIT_PAGE_SIZE]; // pages read by some compiled block (quick filter for writes)
+};
+
+struct Jit *emulator_jit_create(void) {
+  struct Jit *jit = calloc(1, sizeof(struct Jit));
+  if (!jit) return NULL;
+
+  void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    fprintf(stderr, "Could not allocate executable memory for the recompiler\n");
+    free(jit);
+    return NULL;
+  }
+  jit->code = code;
+  return jit;
+}
+
+void emulator_jit_destroy(struct Jit *jit) {
+  if (!jit) return;
+  munmap(jit->code, JIT_CODE_SIZE);
+  free(jit);
+}
+
+void emulator_jit_flush(struct Jit *jit) {
+  jit->code_used = 0;
+  memset(jit->blocks, 0, sizeof jit->blocks);
+  memset(jit->page_has_code, 0, sizeof jit->page_has_code);
+}
+
+void emulator_jit_invalidate(struct Jit *jit, uint16_t address, uint16_t length) {
+  const uint32_t end = (uint32_t)address + length;
+
+  // Writes through I wrap around the end of RAM (the loops below stop there)
+  if (end > RAM_SIZE) emulator_jit_invalidate(jit, 0, end - RAM_SIZE);
+
+  bool has_code = false;
+  for (uint32_t page = address / JIT_PAGE_SIZE; page <= (end - 1) / JIT_PAGE_SIZE && page < RAM_SIZE / JIT_PAGE_SIZE; page++)
+    has_code |= jit->page_has_code[page];
+  if (!has_code) return;
+
+  // A block covers [start, start + 2 * length + 2), so only blocks starting less than 2 * JIT_MAX_BLOCK_INSTRUCTIONS + 2
+  // bytes before the written range can overlap it (at any address, odd ones included).
+  // Their machine code is just abandoned; the buffer is reclaimed by the next flush.
+  const uint32_t reach = JIT_MAX_BLOCK_INSTRUCTIONS * 2 + 1;
+  const uint32_t first = address > reach ? address - reach : 0;
+  for (uint32_t start = first; start < end && start < RAM_SIZE; start++) {
+    struct JitBlock *block = &jit->blocks[start];
+    // Compiled blocks also depend on the instruction after their last one, which sizes an XO-CHIP skip
+    const uint32_t block_end = start + (block->status == JIT_BLOCK_COMPILED ? block->length * 2u + 2u : 2u);
+    if (block_end > address) {
+      block->status = JIT_BLOCK_UNCOMPILED;
+      block->executions = 0;
+    }
+  }
+}
+
+// Machine code emission
+
+struct JitEmitter {
+  uint8_t *start;
+  uint8_t *cursor;
+};
+
+static void emit8(struct JitEmitter *emitter, uint8_t byte) {
+  *emitter->cursor++ = byte;
+}
+
+static void emit16(struct JitEmitter *emitter, uint16_t value) {
+  emit8(emitter, value & 0xFF);
+  emit8(emitter, value >> 8);
+}
+
+static void emit32(struct JitEmitter *emitter, uint32_t value) {
+  emit16(emitter, value & 0xFFFF);
+  emit16(emitter, value >> 16);
+}
+
+// ModRM for [rdi + disp32], reg is a register number or an opcode extension
+static void emit_rdi_operand(struct JitEmitter *emitter, uint8_t reg, uint32_t displacement) {
+  emit8(emitter, 0x80 | (reg << 3) | 7);
+  emit32(emitter, displacement);
+}
+
+#define REG_AL 0
+#define REG_CL 1
+
+#define OFFSET_V(X) ((uint32_t)(offsetof(struct EmulatedSystem, V) + (X)))
+#define OFFSET_I ((uint32_t)offsetof(struct EmulatedSystem, I))
+#define OFFSET_PC ((uint32_t)offsetof(struct EmulatedSystem, PC))
+#define OFFSET_DELAY_TIMER ((uint32_t)offsetof(struct EmulatedSystem, delay_timer))
+#define OFFSET_SOUND_TIMER ((uint32_t)offsetof(struct EmulatedSystem, sound_timer))
+#define OFFSET_KEYPAD ((uint32_t)offsetof(struct EmulatedSystem, keypad))
+#define OFFSET_STACK ((uint32_t)offsetof(struct EmulatedSystem, stack))
+#define OFFSET_STACK_DEPTH ((uint32_t)offsetof(struct EmulatedSystem, stack_depth))
+
+// mov r8, [rdi + offset]
+static void emit_load8(struct JitEmitter *emitter, uint8_t reg, uint32_t offset) {
+  emit8(emitter, 0x8A);
+  emit_rdi_operand(emitter, reg, offset);
+}
+
+// mov [rdi + offset], r8
+static void emit_store8(struct JitEmitter *emitter, uint8_t reg, uint32_t offset) {
+  emit8(emitter, 0x88);
+  emit_rdi_operand(emitter, reg, offset);
+}
+
+// mov byte [rdi + offset], imm8
+static void emit_store8_immediate(struct JitEmitter *emitter, uint32_t offset, uint8_t value) {
+  emit8(emitter, 0xC6);
+  emit_rdi_operand(emitter, 0, offset);
+  emit8(emitter, value);
+}
+
+// mov word [rdi + offset], imm16
+static void emit_store16_immediate(struct JitEmitter *emitter, uint32_t offset, uint16_t value) {
+  emit8(emitter, 0x66);
+  emit8(emitter, 0xC7);
+  emit_rdi_operand(emitter, 0, offset);
+  emit16(emitter, value);
+}
+
+// movzx eax, byte [rdi + offset]
+static void emit_load8_zero_extend(struct JitEmitter *emitter, uint32_t offset) {
+  emit8(emitter, 0x0F);
+  emit8(emitter, 0xB6);
+  emit_rdi_operand(emitter, REG_AL, offset);
+}
+
+// Stores carry (CF or !CF, from the previous instruction) into VF after the result in al is stored into VX
+static void emit_store_result_and_flag(struct JitEmitter *emitter, uint8_t X, bool flag_is_not_carry) {
+  emit8(emitter, 0x0F); emit8(emitter, flag_is_not_carry ? 0x93 : 0x92); emit8(emitter, 0xC1); // setnc/setc cl
+  emit_store8(emitter, REG_AL, OFFSET_V(X));
+  emit_store8(emitter, REG_CL, OFFSET_V(0xF));
+}
+
+// PC = condition ? skip_target : next (condition from the flags of the previous instruction)
+static void emit_skip(struct JitEmitter *emitter, const struct Emulator *emulator, uint16_t next, bool skip_if_equal) {
+  const uint16_t skip_target = next + emulator_instruction_length(emulator, next);
+  emit8(emitter, 0xB8); emit32(emitter, next);        // mov eax, next
+  emit8(emitter, 0xB9); emit32(emitter, skip_target); // mov ecx, skip_target
+  emit8(emitter, 0x0F); emit8(emitter, skip_if_equal ? 0x44 : 0x45); emit8(emitter, 0xC1); // cmove/cmovne eax, ecx
+  emit8(emitter, 0x66); emit8(emitter, 0x89); emit_rdi_operand(emitter, REG_AL, OFFSET_PC); // mov [PC], ax
+}
+
+// Emits one instruction. Returns false when it must be left to the interpreter, *ends_block when it
+// changes the control flow (PC was stored). *stack_change is set for calls and returns, whose stack bounds
+// emulator_jit_execute() checks before the block runs.
+static bool emit_instruction(struct JitEmitter *emitter, const struct Emulator *emulator, uint16_t address, bool *ends_block, int8_t *stack_change) {
+  const uint8_t *ram = emulator->emulated_system.ram;
+  const uint16_t opcode = (ram[address] << 8) | ram[address + 1];
+  const uint16_t NNN = opcode & 0x0FFF;
+  const uint8_t NN = opcode & 0xFF;
+  const uint8_t N = opcode & 0x0F;
+  const uint8_t X = (opcode >> 8) & 0x0F;
+  const uint8_t Y = (opcode >> 4) & 0x0F;
+  const uint16_t next = address + 2;
+
+  *ends_block = false;
+  *stack_change = 0;
+
+  switch (opcode >> 12) {
+    case 0x0:
+      if (opcode == 0x00EE) {
+        // PC = stack[--stack_depth]
+        emit8(emitter, 0xFE); emit_rdi_operand(emitter, 1, OFFSET_STACK_DEPTH);                           // dec byte [stack_depth]
+        emit_load8_zero_extend(emitter, OFFSET_STACK_DEPTH);
+        emit8(emitter, 0x0F); emit8(emitter, 0xB7); emit8(emitter, 0x8C); emit8(emitter, 0x47); emit32(emitter, OFFSET_STACK); // movzx ecx, word [rdi + rax * 2 + stack]
+        emit8(emitter, 0x66); emit8(emitter, 0x89); emit_rdi_operand(emitter, REG_CL, OFFSET_PC);        // mov [PC], cx
+        *ends_block = true;
+        *stack_change = -1;
+        return true;
+      }
+      return false; // 00E0 writes the display
+
+    case 0x1:
+      emit_store16_immediate(emitter, OFFSET_PC, NNN);
+      *ends_block = true;
+      return true;
+
+    case 0x2:
+      // stack[stack_depth++] = next; PC = NNN
+      emit_load8_zero_extend(emitter, OFFSET_STACK_DEPTH);
+      emit8(emitter, 0x66); emit8(emitter, 0xC7); emit8(emitter, 0x84); emit8(emitter, 0x47); emit32(emitter, OFFSET_STACK); emit16(emitter, next); // mov word [rdi + rax * 2 + stack], next
+      emit8(emitter, 0xFE); emit_rdi_operand(emitter, 0, OFFSET_STACK_DEPTH);                            // inc byte [stack_depth]
+      emit_store16_immediate(emitter, OFFSET_PC, NNN);
+      *ends_block = true;
+      *stack_change = 1;
+      return true;
+
+    case 0x3:
+    case 0x4:
+      emit8(emitter, 0x80); emit_rdi_operand(emitter, 7, OFFSET_V(X)); emit8(emitter, NN); // cmp byte [VX], NN
+      emit_skip(emitter, emulator, next, (opcode >> 12) == 0x3);
+      *ends_block = true;
+      return true;
+
+    case 0x5:
+    case 0x9:
+      if (N != 0) return false;
+      emit_load8(emitter, REG_AL, OFFSET_V(X));
+      emit8(emitter, 0x3A); emit_rdi_operand(emitter, REG_AL, OFFSET_V(Y)); // cmp al, [VY]
+      emit_skip(emitter, emulator, next, (opcode >> 12) == 0x5);
+      *ends_block = true;
+      return true;
+
+    case 0x6:
+      emit_store8_immediate(emitter, OFFSET_V(X), NN);
+      return true;
+
+    case 0x7:
+      emit8(emitter, 0x80); emit_rdi_operand(emitter, 0, OFFSET_V(X)); emit8(emitter, NN); // add byte [VX], NN
+      return true;
+
+    case 0x8: {
+      const bool reset_flag = emulator->extension == CHIP8; // VF reset quirk of 8XY1/8XY2/8XY3
+      const uint8_t shift_source = emulator->extension != SUPERCHIP ? Y : X; // shift quirk of 8XY6/8XYE
+
+      switch (N) {
+        case 0x0:
+          emit_load8(emitter, REG_AL, OFFSET_V(Y));
+          emit_store8(emitter, REG_AL, OFFSET_V(X));
+          return true;
+
+        case 0x1:
+        case 0x2:
+        case 0x3: {
+          static const uint8_t operation[] = { [0x1] = 0x08, [0x2] = 0x20, [0x3] = 0x30 }; // or/and/xor [m], r8
+          emit_load8(emitter, REG_AL, OFFSET_V(Y));
+          emit8(emitter, operation[N]); emit_rdi_operand(emitter, REG_AL, OFFSET_V(X));
+          if (reset_flag) emit_store8_immediate(emitter, OFFSET_V(0xF), 0);
+          return true;
+        }
+
+        case 0x4:
+          emit_load8(emitter, REG_AL, OFFSET_V(X));
+          emit8(emitter, 0x02); emit_rdi_operand(emitter, REG_AL, OFFSET_V(Y)); // add al, [VY]
+          emit_store_result_and_flag(emitter, X, false);
+          return true;
+
+        case 0x5:
+          emit_load8(emitter, REG_AL, OFFSET_V(X));
+          emit8(emitter, 0x2A); emit_rdi_operand(emitter, REG_AL, OFFSET_V(Y)); // sub al, [VY]
+          emit_store_result_and_flag(emitter, X, true);
+          return true;
+
+        case 0x7:
+          emit_load8(emitter, REG_AL, OFFSET_V(Y));
+          emit8(emitter, 0x2A); emit_rdi_operand(emitter, REG_AL, OFFSET_V(X)); // sub al, [VX]
+          emit_store_result_and_flag(emitter, X, true);
+          return true;
+
+        case 0x6:
+        case 0xE:
+          emit_load8(emitter, REG_AL, OFFSET_V(shift_source));
+          emit8(emitter, 0xD0); emit8(emitter, N == 0x6 ? 0xE8 : 0xE0); // shr/shl al, 1
+          emit_store_result_and_flag(emitter, X, false);
+          return true;
+
+        default:
+          return false;
+      }
+    }
+
+    case 0xA:
+      emit_store16_immediate(emitter, OFFSET_I, NNN);
+      return true;
+
+    case 0xB:
+      emit_load8_zero_extend(emitter, OFFSET_V(emulator->extension == SUPERCHIP ? X : 0)); // BXNN quirk
+      emit8(emitter, 0x05); emit32(emitter, NNN);                                             // add eax, NNN
+      emit8(emitter, 0x66); emit8(emitter, 0x89); emit_rdi_operand(emitter, REG_AL, OFFSET_PC); // mov [PC], ax
+      *ends_block = true;
+      return true;
+
+    case 0xE:
+      if (NN != 0x9E && NN != 0xA1) return false;
+      emit_load8_zero_extend(emitter, OFFSET_V(X));
+      emit8(emitter, 0x83); emit8(emitter, 0xE0); emit8(emitter, 0x0F); // and eax, 0xF
+      emit8(emitter, 0x80); emit8(emitter, 0xBC); emit8(emitter, 0x07); emit32(emitter, OFFSET_KEYPAD); emit8(emitter, 0); // cmp byte [rdi + rax + keypad], 0
+      emit_skip(emitter, emulator, next, NN == 0xA1); // EXA1 skips when the key is not pressed (== 0)
+      *ends_block = true;
+      return true;
+
+    case 0xF:
+      switch (NN) {
+        case 0x07:
+          emit_load8(emitter, REG_AL, OFFSET_DELAY_TIMER);
+          emit_store8(emitter, REG_AL, OFFSET_V(X));
+          return true;
+
+        case 0x15:
+        case 0x18:
+          emit_load8(emitter, REG_AL, OFFSET_V(X));
+          emit_store8(emitter, REG_AL, NN == 0x15 ? OFFSET_DELAY_TIMER : OFFSET_SOUND_TIMER);
+          return true;
+
+        case 0x1E:
+          emit_load8_zero_extend(emitter, OFFSET_V(X));
+          emit8(emitter, 0x66); emit8(emitter, 0x01); emit_rdi_operand(emitter, REG_AL, OFFSET_I); // add [I], ax
+          return true;
+
+        case 0x29:
+          emit_load8_zero_extend(emitter, OFFSET_V(X));
+          emit8(emitter, 0x8D); emit8(emitter, 0x04); emit8(emitter, 0x80);                        // lea eax, [rax + rax * 4]
+          emit8(emitter, 0x66); emit8(emitter, 0x89); emit_rdi_operand(emitter, REG_AL, OFFSET_I); // mov [I], ax
+          return true;
+
+        default:
+          return false; // FX0A waits for keys, FX33/FX55/FX65 access RAM, F000 NNNN is four bytes long
+      }
+
+    default:
+      return false; // CXNN (rand) and DXYN (display)
+  }
+}
+
+// Flips the code buffer between writable and executable; never both, so hardened kernels and execmem policies
+// accept it
+static bool emulator_jit_set_writable(struct Jit *jit, bool writable) {
+  if (mprotect(jit->code, JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0) return true;
+
+  perror("recompiler: mprotect");
+  return false;
+}
+
+static void emulator_jit_compile(struct Emulator *emulator, uint16_t start) {
+  struct Jit *jit = emulator->jit;
+  struct JitBlock *block = &jit->blocks[start];
+
+  if (jit->code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) emulator_jit_flush(jit);
+  if (!emulator_jit_set_writable(jit, true)) {
+    block->status = JIT_BLOCK_INTERPRETED;
+    return;
+  }
+
+  struct JitEmitter emitter = { .start = jit->code + jit->code_used, .cursor = jit->code + jit->code_used };
+  uint16_t address = start;
+  uint16_t length = 0;
+  bool ends_block = false;
+  int8_t stack_change = 0;
+  const uint32_t ram_size = emulator_ram_size(emulator);
+
+  // Same limit as emulator_emulate_instruction(): instructions past it make the emulator quit
+  while (length < JIT_MAX_BLOCK_INSTRUCTIONS && address < ram_size - 3 && !ends_block) {
+    uint8_t *const rollback = emitter.cursor;
+    if (!emit_instruction(&emitter, emulator, address, &ends_block, &stack_change)) {
+      emitter.cursor = rollback;
+      break;
+    }
+    address += 2;
+    length++;
+  }
+
+  if (length != 0) {
+    if (!ends_block) emit_store16_immediate(&emitter, OFFSET_PC, address);
+    emit8(&emitter, 0xC3); // ret
+  }
+
+  if (!emulator_jit_set_writable(jit, false) || length == 0) {
+    block->status = JIT_BLOCK_INTERPRETED;
+    return;
+  }
+
+  // ISO C has no conversion from object pointers to function pointers
+  memcpy(&block->code, &emitter.start, sizeof block->code);
+  block->length = length;
+  block->stack_change = stack_change;
+  block->status = JIT_BLOCK_COMPILED;
+  jit->code_used += emitter.cursor - emitter.start;
+
+  for (uint32_t page = start / JIT_PAGE_SIZE; page <= (uint32_t)(address + 3) / JIT_PAGE_SIZE && page < RAM_SIZE / JIT_PAGE_SIZE; page++)
+    jit->page_has_code[page] = true;
+}
+
+uint32_t emulator_jit_execute(struct Emulator *emulator, uint64_t budget) {
+  struct Jit *jit = emulator->jit;
+  const uint16_t PC = emulator->emulated_system.PC;
+
+  if (PC >= emulator_ram_size(emulator) - 3) return 0; // the interpreter reports it
+
+  struct JitBlock *block = &jit->blocks[PC];
+  if (block->status == JIT_BLOCK_UNCOMPILED) {
+    if (++block->executions < JIT_COMPILE_THRESHOLD) return 0;
+    emulator_jit_compile(emulator, PC);
+  }
+
+  // A block runs entirely or not at all, so frames execute exactly the same instructions as the interpreter
+  if (block->status != JIT_BLOCK_COMPILED || block->length > budget) return 0;
+
+  // Only the last instruction of a block touches the stack, so the depth is the same when it runs. A call on a
+  // full stack or a return on an empty one is left to the interpreter, which reports it and quits.
+  const uint8_t stack_depth = emulator->emulated_system.stack_depth;
+  if ((block->stack_change > 0 && stack_depth >= STACK_SIZE) || (block->stack_change < 0 && stack_depth == 0)) return 0;
+
+  block->code(&emulator->emulated_system);
+  return block->length;
+}
+
+#else // No recompiler for this host
+
+struct Jit *emulator_jit_create(void) {
+  fprintf(stderr, "The recompiler is only available on x86-64\n");
+  return NULL;
+}
+
+void emulator_jit_destroy(struct Jit *jit) {
+  (void)jit;
+}
+
+uint32_t emulator_jit_execute(struct Emulator *emulator, uint64_t budget) {
+  (void)emulator; (void)budget;
+  return 0;
+}
+
+void emulator_jit_invalidate(struct Jit *jit, uint16_t address, uint16_t length) {
+  (void)jit; (void)address; (void)length;
+}
+
+void emulator_jit_flush(struct Jit *jit) {
+  (void)jit;
+}
+
+#endif
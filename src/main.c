@@ -1,37 +1,332 @@
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h> // time()
 
+#include "capture.h"
 #include "emulator.h"
+#include "headless.h"
+#include "movie.h"
+#include "profile.h"
+#include "trace.h"
+#include "verify.h"
+#include "rewind.h"
+#include "scheduler.h"
+#ifdef TRACUA_CHIP8_HAVE_SDL
+#include "beeper.h"
+#include "emulation_thread.h"
+#include "user_interface/sdl/interface.h"
+#endif
 
-bool consume_command_line_arguments(struct Emulator *emulator, int argc, char **argv) {
+#define PROFILE_TOP_ADDRESSES 20
+#define TRACE_RING_RECORDS (1 << 18) // 2 MiB (8-byte records)
+
+struct Arguments {
+    const char *rom_name;
+    bool headless;
+    uint32_t scale_factor; // 0 keeps the user interface default
+    uint32_t instructions_per_second; // 0 keeps the emulator default
+    uint64_t max_frames; // headless only, 0 = unlimited
+    bool jit;
+    bool run_idle_loops; // disables idle loop skipping
+    uint32_t extension; // CHIP8, SUPERCHIP or XOCHIP
+    bool profile; // report opcode mix and hot addresses on exit
+    const char *trace; // binary execution trace, see tracua-chip8-tracedump
+    bool has_seed;
+    uint64_t seed; // CXNN random generator seed, current time by default
+    const char *idle_conditions; // comma separated: pause, minimized, unfocused (or never); NULL keeps the default
+    const char *record_movie;
+    const char *play_movie; // headless runs stop at its end unless --frames is given
+    bool turbo; // window only, start in fast-forward
+    uint32_t turbo_multiplier; // 0 = uncapped
+    bool has_rewind_seconds;
+    uint32_t rewind_seconds; // 0 disables rewind; headless, only reports what the buffer would hold
+    uint32_t audio_buffer_samples; // window only, 0 keeps the user interface default
+    uint32_t input_slices; // window only, 0 keeps the default
+    bool input_latency; // window only, report key press to key read latency on exit
+    const char *record; // video of every emulated frame, see capture.h for the formats
+    uint32_t record_scale; // 0 = 1
+    bool verify; // headless, lockstep against the reference interpreter
+    uint64_t verify_interval; // instructions between comparisons, 0 = once per frame
+};
+
+bool consume_command_line_arguments(struct Arguments *arguments, int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <rom_name>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <rom_name> [--headless] [--cpu=jit|interp] [--extension=chip8|superchip|xochip] [--no-idle-skip] [--profile] [--trace FILE] [--frames N] [--ips N] [--seed N] [--scale-factor N] [--idle-when pause,minimized,unfocused|never] [--rewind-seconds N] [--record-movie FILE] [--play-movie FILE] [--turbo N|max] [--audio-buffer N] [--input-slices N] [--input-latency] [--record FILE.y4m|FILE.png|FILE.rgba] [--record-scale N] [--verify] [--verify-every N]\n", argv[0]);
         return false;
     }
 
-   for (int i = 1; i < argc; i++) {
-        if (strncmp(argv[i], "--scale-factor", strlen("--scale-factor")) == 0) {
+    arguments->rom_name = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            arguments->headless = true;
+        }
+        else if (strcmp(argv[i], "--cpu=jit") == 0) {
+            arguments->jit = true;
+        }
+        else if (strcmp(argv[i], "--cpu=interp") == 0) {
+            arguments->jit = false;
+        }
+        else if (strcmp(argv[i], "--extension=superchip") == 0) {
+            arguments->extension = SUPERCHIP;
+        }
+        else if (strcmp(argv[i], "--extension=xochip") == 0) {
+            arguments->extension = XOCHIP;
+        }
+        else if (strcmp(argv[i], "--extension=chip8") == 0) {
+            arguments->extension = CHIP8;
+        }
+        else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+            arguments->run_idle_loops = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            arguments->profile = true;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            arguments->verify = true;
+            arguments->headless = true;
+        }
+        else if (strcmp(argv[i], "--input-latency") == 0) {
+            arguments->input_latency = true;
+        }
+        else if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete argument %s\n", argv[i]);
+            return false;
+        }
+        else if (strncmp(argv[i], "--scale-factor", strlen("--scale-factor")) == 0) {
+            i++;
+            arguments->scale_factor = (uint32_t)strtol(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--frames", strlen("--frames")) == 0) {
+            i++;
+            arguments->max_frames = (uint64_t)strtoull(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--idle-when", strlen("--idle-when")) == 0) {
+            i++;
+            arguments->idle_conditions = argv[i];
+        }
+        else if (strncmp(argv[i], "--seed", strlen("--seed")) == 0) {
+            i++;
+            arguments->has_seed = true;
+            arguments->seed = (uint64_t)strtoull(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--trace", strlen("--trace")) == 0) {
+            i++;
+            arguments->trace = argv[i];
+        }
+        else if (strncmp(argv[i], "--turbo", strlen("--turbo")) == 0) {
+            i++;
+            arguments->turbo = true;
+            arguments->turbo_multiplier = strcmp(argv[i], "max") == 0 ? 0 : (uint32_t)strtoul(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--record-movie", strlen("--record-movie")) == 0) {
+            i++;
+            arguments->record_movie = argv[i];
+        }
+        else if (strncmp(argv[i], "--play-movie", strlen("--play-movie")) == 0) {
+            i++;
+            arguments->play_movie = argv[i];
+        }
+        else if (strncmp(argv[i], "--rewind-seconds", strlen("--rewind-seconds")) == 0) {
+            i++;
+            arguments->has_rewind_seconds = true;
+            arguments->rewind_seconds = (uint32_t)strtoul(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--audio-buffer", strlen("--audio-buffer")) == 0) {
+            i++;
+            arguments->audio_buffer_samples = (uint32_t)strtoul(argv[i], NULL, 10);
+            if (arguments->audio_buffer_samples == 0 || arguments->audio_buffer_samples > 32768) {
+                fprintf(stderr, "--audio-buffer takes 1 to 32768 samples\n");
+                return false;
+            }
+        }
+        else if (strncmp(argv[i], "--input-slices", strlen("--input-slices")) == 0) {
+            i++;
+            arguments->input_slices = (uint32_t)strtol(argv[i], NULL, 10);
+            if (arguments->input_slices == 0 || arguments->input_slices > 64) {
+                fprintf(stderr, "--input-slices takes 1 to 64\n");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--record") == 0) {
+            i++;
+            arguments->record = argv[i];
+        }
+        else if (strcmp(argv[i], "--record-scale") == 0) {
+            i++;
+            arguments->record_scale = (uint32_t)strtol(argv[i], NULL, 10);
+            if (arguments->record_scale == 0 || arguments->record_scale > 16) {
+                fprintf(stderr, "--record-scale takes 1 to 16\n");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--verify-every") == 0) {
             i++;
-            emulator->user_interface.scale_factor = (uint32_t)strtol(argv[i], NULL, 10);
+            arguments->verify_interval = strtoull(argv[i], NULL, 10);
+        }
+        else if (strncmp(argv[i], "--ips", strlen("--ips")) == 0) {
+            i++;
+            arguments->instructions_per_second = (uint32_t)strtol(argv[i], NULL, 10);
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return false;
         }
     }
-    emulator_load_rom(emulator, argv[1]);
     return true;
 }
 
+static const uint32_t capture_default_palette[4] = CAPTURE_DEFAULT_PALETTE;
+
+// Starts capturing video, at the largest resolution of the machine
+static bool record(struct Emulator *emulator, const struct Arguments *arguments, const uint32_t palette[4]) {
+    const bool hires_capable = emulator->extension != CHIP8;
+    const uint32_t width = hires_capable ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+    const uint32_t height = hires_capable ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+
+    emulator->capture = emulator_capture_open(arguments->record, width, height, arguments->record_scale ? arguments->record_scale : 1, palette);
+    return emulator->capture != NULL;
+}
+
 int main(int argc, char **argv) {
     struct Emulator emulator;
+    struct Arguments arguments = {0};
+
+#ifndef TRACUA_CHIP8_HAVE_SDL
+    arguments.headless = true; // built without SDL
+#endif
+
+    if (!consume_command_line_arguments(&arguments, argc, argv)) return EXIT_FAILURE;
 
     emulator_initialize(&emulator);
+    if (arguments.instructions_per_second != 0) emulator.instructions_per_second = arguments.instructions_per_second;
+    if (arguments.jit) emulator.cpu = CPU_JIT;
+    emulator.extension = arguments.extension;
+    emulator.skip_idle_loops = !arguments.run_idle_loops;
 
-    if (!consume_command_line_arguments(&emulator, argc, argv)) return EXIT_FAILURE;
-    else {
-        srand(time(NULL));
+    // Movies keep their own seed, speed and extension; the extension is applied before the ROM is loaded, as it
+    // sets the largest ROM size
+    if (arguments.play_movie) {
+        emulator.movie = emulator_movie_play(arguments.play_movie, &emulator);
+        if (!emulator.movie) return EXIT_FAILURE;
+        if (arguments.headless && arguments.max_frames == 0) arguments.max_frames = emulator_movie_length(emulator.movie);
+    }
+    if (!emulator_load_rom(&emulator, arguments.rom_name)) return EXIT_FAILURE;
 
-        while (emulator.emulated_system.state != QUIT) {
-            if (emulator.emulated_system.state != PAUSE) emulator_update(&emulator);
+    if (emulator.movie) {
+        if (!emulator_movie_matches_rom(emulator.movie, emulator.emulated_system.rom_crc)) {
+            fprintf(stderr, "Movie %s was recorded with another ROM\n", arguments.play_movie);
+            return EXIT_FAILURE;
         }
-        emulator_destroy(&emulator); 
-        return EXIT_SUCCESS;
     }
-}
\ No newline at end of file
+    else emulated_seed_random(&emulator.emulated_system, arguments.has_seed ? arguments.seed : (uint64_t)time(NULL));
+
+    if (arguments.record_movie && !arguments.play_movie) {
+        emulator.movie = emulator_movie_record(arguments.record_movie, &emulator);
+        if (!emulator.movie) return EXIT_FAILURE;
+    }
+
+    if (arguments.profile) emulator.profile = emulator_profile_create();
+    if (arguments.trace) {
+        emulator.trace = emulator_trace_open(arguments.trace, TRACE_RING_RECORDS);
+        if (!emulator.trace) return EXIT_FAILURE;
+    }
+    if (arguments.jit && (emulator.profile || emulator.trace)) fprintf(stderr, "Profiling and tracing run on the interpreter\n");
+    if (arguments.input_latency && !arguments.headless) {
+        // Compiled blocks read the keypad without seeing the key presses, so the measurement needs the interpreter
+        if (arguments.jit) fprintf(stderr, "Input latency is measured on the interpreter\n");
+        emulator.cpu = CPU_INTERPRETER;
+    }
+
+    if (arguments.headless) {
+        if (arguments.record && !record(&emulator, &arguments, capture_default_palette)) return EXIT_FAILURE;
+        // Only on request here: it costs the snapshots, and shows what a window of that length holds
+        if (arguments.has_rewind_seconds && arguments.rewind_seconds != 0 && !arguments.verify)
+            emulator.rewind = emulator_rewind_create(arguments.rewind_seconds * 60, REWIND_DEFAULT_MEMORY);
+        bool verified = true;
+        if (arguments.verify) verified = emulator_verify_run(&emulator, arguments.max_frames, arguments.verify_interval, stdout);
+        else emulator_headless_run(&emulator, arguments.max_frames);
+        if (emulator.profile) emulator_profile_report(emulator.profile, &emulator.emulated_system, stdout, PROFILE_TOP_ADDRESSES);
+        if (emulator.rewind)
+            printf("rewind: %u frames held in %zu bytes\n", emulator_rewind_frames(emulator.rewind), emulator_rewind_memory_used(emulator.rewind));
+        const bool movie_saved = emulator_movie_close(emulator.movie);
+        if (!movie_saved) fprintf(stderr, "Could not save movie %s\n", arguments.record_movie);
+        emulator.movie = NULL;
+        const bool video_saved = emulator_capture_close(emulator.capture);
+        if (!video_saved) fprintf(stderr, "Could not save video %s\n", arguments.record);
+        emulator.capture = NULL;
+        const bool trace_saved = emulator_trace_close(emulator.trace);
+        if (!trace_saved) fprintf(stderr, "Could not save trace %s\n", arguments.trace);
+        emulator.trace = NULL;
+        emulator_destroy(&emulator);
+        return movie_saved && video_saved && trace_saved && verified ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+#ifdef TRACUA_CHIP8_HAVE_SDL
+    struct UserInterface user_interface;
+    struct EmulationThread emulation;
+
+    emulator_thread_initialize(&emulation, &emulator);
+    if (arguments.input_slices != 0) emulation.input_slices = arguments.input_slices;
+    emulation.controls.input.measure_latency = arguments.input_latency;
+    emulator_user_interface_set_defaults(&user_interface);
+    if (arguments.scale_factor != 0) user_interface.scale_factor = arguments.scale_factor;
+    if (arguments.idle_conditions) {
+        user_interface.idle_when_paused = strstr(arguments.idle_conditions, "pause") != NULL;
+        user_interface.idle_when_minimized = strstr(arguments.idle_conditions, "minimized") != NULL;
+        user_interface.idle_when_unfocused = strstr(arguments.idle_conditions, "unfocused") != NULL;
+    }
+    if (arguments.audio_buffer_samples != 0) user_interface.audio_buffer_samples = arguments.audio_buffer_samples;
+    if (arguments.turbo) {
+        user_interface.fast_forward = true;
+        user_interface.fast_forward_multiplier = arguments.turbo_multiplier;
+    }
+    if (!emulator_user_interface_initialize(&user_interface, &emulation)) return EXIT_FAILURE;
+    if (arguments.record) {
+        const uint32_t palette[4] = {
+            user_interface.bg_color, user_interface.fg_color, user_interface.plane2_color, user_interface.blend_color,
+        };
+        if (!record(&emulator, &arguments, palette)) return EXIT_FAILURE;
+    }
+
+    const uint32_t rewind_seconds = arguments.has_rewind_seconds ? arguments.rewind_seconds : REWIND_DEFAULT_SECONDS;
+    if (rewind_seconds != 0) emulator.rewind = emulator_rewind_create(rewind_seconds * 60, REWIND_DEFAULT_MEMORY);
+
+    // The emulation runs (and paces itself) on its own thread; this one handles events and draws at 60hz
+    if (!emulator_thread_start(&emulation)) return EXIT_FAILURE;
+
+    struct Scheduler scheduler;
+    emulator_scheduler_start(&scheduler, emulator_headless_now_ns(), 0);
+    while (!atomic_load_explicit(&emulation.controls.quit, memory_order_acquire)) {
+        emulator_user_interface_update(&user_interface, &emulation);
+        emulator_scheduler_frames_due(&scheduler, emulator_headless_now_ns());
+        emulator_user_interface_wait_events(&user_interface, &emulation, emulator_scheduler_deadline(&scheduler, scheduler.frames));
+        emulator_scheduler_wait(&scheduler);
+    }
+    emulator_thread_stop(&emulation);
+
+    const struct EmulatorInput *input = &emulation.controls.input;
+    if (input->measure_latency) {
+        if (input->latency_samples == 0) puts("Input latency: no key press was read by the ROM");
+        else printf("Input latency: %llu key presses, %.2f ms mean, %.2f ms max (key down to the first instruction reading it)\n",
+                    (unsigned long long)input->latency_samples, input->latency_total_ns / 1e6 / input->latency_samples, input->latency_max_ns / 1e6);
+    }
+    // Sound glitches: the callback found no frame queued, or frames came faster than it played them
+    if (emulator.beeper && (emulator_beeper_underruns(emulator.beeper) || emulator_beeper_dropped(emulator.beeper)))
+        fprintf(stderr, "audio: %llu underruns, %llu frames dropped (see --audio-buffer)\n",
+                (unsigned long long)emulator_beeper_underruns(emulator.beeper), (unsigned long long)emulator_beeper_dropped(emulator.beeper));
+
+    emulator_user_interface_destroy(&user_interface);
+    if (emulator.profile) emulator_profile_report(emulator.profile, &emulator.emulated_system, stdout, PROFILE_TOP_ADDRESSES);
+    if (!emulator_movie_close(emulator.movie)) fprintf(stderr, "Could not save movie %s\n", arguments.record_movie);
+    emulator.movie = NULL;
+    if (!emulator_capture_close(emulator.capture)) fprintf(stderr, "Could not save video %s\n", arguments.record);
+    emulator.capture = NULL;
+    if (!emulator_trace_close(emulator.trace)) fprintf(stderr, "Could not save trace %s\n", arguments.trace);
+    emulator.trace = NULL;
+#endif
+    emulator_destroy(&emulator);
+    return EXIT_SUCCESS;
+}
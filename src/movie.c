@@ -0,0 +1,211 @@
+// Input movies
+//
+// File format, integers little-endian:
+//
+//   header  "TC8M", u16 version, u16 extension (0 = CHIP-8, 1 = SUPER-CHIP, 2 = XO-CHIP), u32 ROM CRC-32,
+//           u32 instructions per second, u64 random generator state, u64 frame count
+//   events  LEB128 frames since the previous event, u16 keypad (bit k = key k pressed)
+//
+// An event is stored only when the keypad differs from the previous frame, so a movie is a few bytes
+// per key press. The emulator only reads the keypad inside emulator_update(), so applying it once at the
+// start of each frame replays a run exactly.
+
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 32
+#define MOVIE_FRAME_COUNT_OFFSET 24
+
+struct Movie {
+    bool recording;
+    FILE *file; // recording only
+    bool failed; // recording: an event was not written, the movie would replay differently
+    uint64_t frame; // frames seen since the movie started
+    uint64_t last_event_frame;
+    uint16_t keypad; // keypad in effect
+
+    // playback
+    uint8_t *events;
+    size_t events_size;
+    size_t events_cursor;
+    uint64_t next_event_frame;
+    uint64_t length;
+    uint32_t rom_crc;
+};
+
+static uint16_t movie_keypad_mask(const struct EmulatedSystem *emulated_system) {
+    uint16_t mask = 0;
+    for (int key = 0; key < 16; key++) mask |= (uint16_t)emulated_system->keypad[key] << key;
+    return mask;
+}
+
+static void movie_put(uint8_t *cursor, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) cursor[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint64_t movie_get(const uint8_t *cursor, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= (uint64_t)cursor[i] << (8 * i);
+    return value;
+}
+
+struct Movie *emulator_movie_record(const char *filename, const struct Emulator *emulator) {
+    const struct EmulatedSystem *emulated_system = &emulator->emulated_system;
+    uint8_t header[MOVIE_HEADER_SIZE] = "TC8M";
+
+    movie_put(header + 4, MOVIE_VERSION, 2);
+    movie_put(header + 6, emulator->extension, 2);
+    movie_put(header + 8, emulated_system->rom_crc, 4);
+    movie_put(header + 12, emulator->instructions_per_second, 4);
+    movie_put(header + 16, emulated_system->random_state, 8);
+
+    struct Movie *movie = calloc(1, sizeof(struct Movie));
+    if (!movie) return NULL;
+
+    movie->recording = true;
+    movie->file = fopen(filename, "wb");
+    if (!movie->file || fwrite(header, sizeof header, 1, movie->file) != 1) {
+        fprintf(stderr, "Could not create movie %s\n", filename);
+        if (movie->file) fclose(movie->file);
+        free(movie);
+        return NULL;
+    }
+    return movie;
+}
+
+// Reads the delta of the next event, or sets it beyond the end of the movie
+static void movie_read_next_event(struct Movie *movie) {
+    uint64_t delta = 0;
+    int shift = 0;
+
+    while (movie->events_cursor < movie->events_size && shift < 64) {
+        const uint8_t byte = movie->events[movie->events_cursor++];
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) {
+            if (movie->events_size - movie->events_cursor < 2) break;
+            movie->next_event_frame = movie->last_event_frame + delta;
+            return;
+        }
+    }
+    movie->next_event_frame = UINT64_MAX;
+}
+
+struct Movie *emulator_movie_play(const char *filename, struct Emulator *emulator) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open movie %s\n", filename);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    rewind(file);
+
+    uint8_t header[MOVIE_HEADER_SIZE];
+    if (file_size < MOVIE_HEADER_SIZE || fread(header, sizeof header, 1, file) != 1 || memcmp(header, "TC8M", 4) != 0) {
+        fprintf(stderr, "%s is not a movie\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    if (movie_get(header + 4, 2) > MOVIE_VERSION) {
+        fprintf(stderr, "Movie %s was made by a newer version\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    if (movie_get(header + 6, 2) > XOCHIP) {
+        fprintf(stderr, "Movie %s needs an unknown extension\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    struct Movie *movie = calloc(1, sizeof(struct Movie));
+    if (!movie) {
+        fclose(file);
+        return NULL;
+    }
+    movie->events_size = (size_t)file_size - MOVIE_HEADER_SIZE;
+    movie->events = malloc(movie->events_size ? movie->events_size : 1);
+    if (!movie->events || (movie->events_size && fread(movie->events, movie->events_size, 1, file) != 1)) {
+        fprintf(stderr, "Could not read movie %s\n", filename);
+        fclose(file);
+        free(movie->events);
+        free(movie);
+        return NULL;
+    }
+    fclose(file);
+
+    emulator->extension = movie_get(header + 6, 2);
+    emulator->instructions_per_second = (uint32_t)movie_get(header + 12, 4);
+    emulated_seed_random(&emulator->emulated_system, movie_get(header + 16, 8));
+    movie->length = movie_get(header + MOVIE_FRAME_COUNT_OFFSET, 8);
+    movie->rom_crc = (uint32_t)movie_get(header + 8, 4);
+    movie_read_next_event(movie);
+    return movie;
+}
+
+void emulator_movie_frame(struct Movie *movie, struct EmulatedSystem *emulated_system) {
+    if (movie->recording) {
+        const uint16_t keypad = movie_keypad_mask(emulated_system);
+
+        if (keypad != movie->keypad) {
+            uint8_t event[10 + 2], *cursor = event;
+            uint64_t delta = movie->frame - movie->last_event_frame;
+            do {
+                *cursor++ = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+                delta >>= 7;
+            } while (delta);
+            movie_put(cursor, keypad, 2);
+            if (!movie->failed && fwrite(event, (size_t)(cursor + 2 - event), 1, movie->file) != 1) {
+                perror("movie: fwrite");
+                movie->failed = true;
+            }
+
+            movie->keypad = keypad;
+            movie->last_event_frame = movie->frame;
+        }
+    }
+    else if (movie->frame < movie->length) {
+        if (movie->frame == movie->next_event_frame) {
+            movie->keypad = (uint16_t)movie_get(movie->events + movie->events_cursor, 2);
+            movie->events_cursor += 2;
+            movie->last_event_frame = movie->frame;
+            movie_read_next_event(movie);
+        }
+        for (int key = 0; key < 16; key++) emulated_system->keypad[key] = (movie->keypad >> key) & 1;
+    }
+
+    movie->frame++;
+}
+
+bool emulator_movie_matches_rom(const struct Movie *movie, uint32_t rom_crc) {
+    return movie->rom_crc == rom_crc;
+}
+
+bool emulator_movie_finished(const struct Movie *movie) {
+    return !movie->recording && movie->frame >= movie->length;
+}
+
+uint64_t emulator_movie_length(const struct Movie *movie) {
+    return movie->recording ? movie->frame : movie->length;
+}
+
+bool emulator_movie_close(struct Movie *movie) {
+    if (!movie) return true;
+
+    bool ok = true;
+    if (movie->recording) {
+        uint8_t frame_count[8];
+        movie_put(frame_count, movie->frame, 8);
+        ok = !movie->failed && !ferror(movie->file)
+             && fseek(movie->file, MOVIE_FRAME_COUNT_OFFSET, SEEK_SET) == 0
+             && fwrite(frame_count, sizeof frame_count, 1, movie->file) == 1;
+        ok &= fclose(movie->file) == 0;
+    }
+    free(movie->events);
+    free(movie);
+    return ok;
+}
@@ -0,0 +1,60 @@
+// Execution profiler
+
+#include "profile.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct Profile *emulator_profile_create(void) {
+    return calloc(1, sizeof(struct Profile));
+}
+
+void emulator_profile_destroy(struct Profile *profile) {
+    free(profile);
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0;
+}
+
+void emulator_profile_report(const struct Profile *profile, const struct EmulatedSystem *emulated_system, FILE *output, uint32_t top) {
+    fprintf(output, "profile: %llu instructions in %llu frames, %.3f ms emulating\n",
+            (long long unsigned)profile->instructions, (long long unsigned)profile->frames, profile->emulation_ns / 1e6);
+
+    // Opcode mix, most executed first
+    fprintf(output, "\nopcode mix:\n");
+    bool reported[OPCODE_CLASS_COUNT] = {0};
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < OPCODE_CLASS_COUNT; i++)
+            if (!reported[i] && profile->class_counts[i] && (best < 0 || profile->class_counts[i] > profile->class_counts[best])) best = i;
+        if (best < 0) break;
+
+        reported[best] = true;
+        fprintf(output, "  %-8s %14llu %6.2f%%\n", emulator_opcode_class_name(best),
+                (long long unsigned)profile->class_counts[best], percent(profile->class_counts[best], profile->instructions));
+    }
+
+    fprintf(output, "\ndrawing (DXYN/00E0): %llu draws, %.3f ms, %.0f ns per draw, %.2f%% of emulation time\n",
+            (long long unsigned)profile->draws, profile->draw_ns / 1e6,
+            profile->draws ? (double)profile->draw_ns / profile->draws : 0.0, percent(profile->draw_ns, profile->emulation_ns));
+
+    // Hot addresses: repeated selection of the largest count below the previous one is enough for a short list
+    fprintf(output, "\nhot addresses:\n");
+    bool *listed = calloc(RAM_SIZE, sizeof(bool));
+    if (!listed) return;
+    for (uint32_t n = 0; n < top; n++) {
+        int best = -1;
+        for (int address = 0; address < RAM_SIZE; address++)
+            if (!listed[address] && profile->pc_counts[address] && (best < 0 || profile->pc_counts[address] > profile->pc_counts[best])) best = address;
+        if (best < 0) break;
+
+        listed[best] = true;
+        const uint16_t opcode = emulated_system->ram[best] << 8 | emulated_system->ram[(best + 1) & RAM_MASK];
+        char text[32];
+        emulator_disassemble(opcode, text, sizeof text);
+        fprintf(output, "  0x%03X  %14llu %6.2f%%  %04X  %s\n", best, (long long unsigned)profile->pc_counts[best],
+                percent(profile->pc_counts[best], profile->instructions), opcode, text);
+    }
+    free(listed);
+}
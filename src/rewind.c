@@ -0,0 +1,226 @@
+// Rewind buffer
+//
+// A snapshot is the raw struct EmulatedSystem (pointer-free, only ever read back by this process), seen
+// as 64-bit words. Every REWIND_KEYFRAME_INTERVAL frames it is stored whole; the frames in between store
+// it XORed with their keyframe. Both are then run-length encoded as (zero words, literal words) pairs,
+// which removes the mostly empty RAM from keyframes and everything that did not change from deltas.
+// Snapshots live in a byte ring; when it is full the oldest keyframe and its deltas are dropped together.
+
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define REWIND_KEYFRAME_INTERVAL 60
+#define REWIND_WORDS ((sizeof(struct EmulatedSystem) + 7) / 8)
+
+// Worst case encoding: a run header before every literal word
+#define REWIND_MAX_ENCODED_WORDS (REWIND_WORDS * 2 + 1)
+
+union RewindImage {
+    struct EmulatedSystem emulated_system;
+    uint64_t words[REWIND_WORDS];
+};
+
+struct RewindRun {
+    uint16_t zero_words;
+    uint16_t literal_words;
+};
+
+struct RewindFrame {
+    size_t offset; // in the arena
+    size_t size; // bytes
+    uint64_t keyframe; // sequence number of the keyframe this frame is relative to (itself for keyframes)
+};
+
+struct Rewind {
+    uint32_t max_frames;
+    struct RewindFrame *frames; // ring indexed by sequence number % max_frames
+    uint64_t oldest; // sequence numbers of the frames held are [oldest, next)
+    uint64_t next;
+
+    uint8_t *arena;
+    size_t arena_size;
+    size_t arena_head; // where the next snapshot goes
+
+    uint64_t keyframe_sequence; // keyframe held in keyframe_image (UINT64_MAX = none)
+    union RewindImage keyframe_image;
+    union RewindImage image;
+    uint64_t encoded[REWIND_MAX_ENCODED_WORDS];
+};
+
+struct Rewind *emulator_rewind_create(uint32_t max_frames, size_t memory_limit) {
+    if (max_frames == 0 || memory_limit < sizeof(uint64_t) * REWIND_MAX_ENCODED_WORDS * 2) return NULL;
+
+    struct Rewind *rewind = calloc(1, sizeof(struct Rewind));
+    if (!rewind) return NULL;
+
+    rewind->max_frames = max_frames;
+    rewind->frames = calloc(max_frames, sizeof(struct RewindFrame));
+    rewind->arena_size = memory_limit;
+    rewind->arena = malloc(memory_limit);
+    rewind->keyframe_sequence = UINT64_MAX;
+    if (!rewind->frames || !rewind->arena) {
+        emulator_rewind_destroy(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+void emulator_rewind_destroy(struct Rewind *rewind) {
+    if (!rewind) return;
+    free(rewind->frames);
+    free(rewind->arena);
+    free(rewind);
+}
+
+static struct RewindFrame *rewind_frame(struct Rewind *rewind, uint64_t sequence) {
+    return &rewind->frames[sequence % rewind->max_frames];
+}
+
+// Encodes image (XOR base, when given) into rewind->encoded; returns its size in bytes
+static size_t rewind_encode(struct Rewind *rewind, const uint64_t *image, const uint64_t *base) {
+    uint64_t *out = rewind->encoded;
+    size_t word = 0;
+
+    while (word < REWIND_WORDS) {
+        struct RewindRun run = {0};
+
+        while (word < REWIND_WORDS && run.zero_words < UINT16_MAX && (image[word] ^ (base ? base[word] : 0)) == 0) {
+            run.zero_words++;
+            word++;
+        }
+        uint64_t *header = out++;
+        while (word < REWIND_WORDS && run.literal_words < UINT16_MAX && (image[word] ^ (base ? base[word] : 0)) != 0) {
+            *out++ = image[word] ^ (base ? base[word] : 0);
+            run.literal_words++;
+            word++;
+        }
+        memcpy(header, &run, sizeof run);
+    }
+    return (size_t)(out - rewind->encoded) * sizeof(uint64_t);
+}
+
+// XORs an encoded snapshot into image (which must start zeroed for keyframes, or as the keyframe for deltas)
+static void rewind_decode(const uint8_t *data, size_t size, uint64_t *image) {
+    const uint8_t *end = data + size;
+    size_t word = 0;
+
+    while (data < end) {
+        struct RewindRun run;
+        memcpy(&run, data, sizeof run);
+        data += sizeof(uint64_t);
+        word += run.zero_words;
+        for (uint16_t i = 0; i < run.literal_words; i++, word++, data += sizeof(uint64_t)) {
+            uint64_t literal;
+            memcpy(&literal, data, sizeof literal);
+            image[word] ^= literal;
+        }
+    }
+}
+
+// Drops the oldest frame, and the deltas that depended on it when it was a keyframe
+static void rewind_drop_oldest(struct Rewind *rewind) {
+    const uint64_t keyframe = rewind->oldest;
+
+    do rewind->oldest++;
+    while (rewind->oldest < rewind->next && rewind_frame(rewind, rewind->oldest)->keyframe == keyframe);
+
+    if (rewind->oldest == rewind->next) rewind->arena_head = 0;
+    if (rewind->keyframe_sequence < rewind->oldest) rewind->keyframe_sequence = UINT64_MAX;
+}
+
+// Finds room for size contiguous bytes in the arena, dropping old frames as needed
+static size_t rewind_allocate(struct Rewind *rewind, size_t size) {
+    for (;;) {
+        if (rewind->oldest == rewind->next) return 0;
+
+        const size_t tail = rewind_frame(rewind, rewind->oldest)->offset;
+        if (rewind->arena_head > tail) {
+            if (rewind->arena_size - rewind->arena_head >= size) return rewind->arena_head;
+            if (tail >= size) return 0; // wrap around
+        }
+        else if (rewind->arena_head < tail && tail - rewind->arena_head >= size) {
+            return rewind->arena_head;
+        }
+        rewind_drop_oldest(rewind);
+    }
+}
+
+// Makes keyframe_image hold the given keyframe
+static void rewind_load_keyframe(struct Rewind *rewind, uint64_t keyframe) {
+    if (rewind->keyframe_sequence == keyframe) return;
+
+    const struct RewindFrame *frame = rewind_frame(rewind, keyframe);
+    memset(&rewind->keyframe_image, 0, sizeof rewind->keyframe_image);
+    rewind_decode(rewind->arena + frame->offset, frame->size, rewind->keyframe_image.words);
+    rewind->keyframe_sequence = keyframe;
+}
+
+void emulator_rewind_capture(struct Rewind *rewind, const struct EmulatedSystem *emulated_system) {
+    memcpy(&rewind->image.emulated_system, emulated_system, sizeof(struct EmulatedSystem));
+
+    if (rewind->next - rewind->oldest == rewind->max_frames) rewind_drop_oldest(rewind);
+
+    // Deltas are relative to the keyframe of the newest frame, while it is recent enough
+    const bool keyframe = rewind->oldest == rewind->next
+                          || rewind->next - rewind_frame(rewind, rewind->next - 1)->keyframe >= REWIND_KEYFRAME_INTERVAL;
+    size_t size;
+    if (keyframe) {
+        size = rewind_encode(rewind, rewind->image.words, NULL);
+    }
+    else {
+        rewind_load_keyframe(rewind, rewind_frame(rewind, rewind->next - 1)->keyframe);
+        size = rewind_encode(rewind, rewind->image.words, rewind->keyframe_image.words);
+    }
+
+    // Room may only be made by dropping the keyframe this delta depends on; store a keyframe instead
+    const uint64_t base = keyframe ? rewind->next : rewind_frame(rewind, rewind->next - 1)->keyframe;
+    size_t offset = rewind_allocate(rewind, size);
+    if (!keyframe && base < rewind->oldest) {
+        size = rewind_encode(rewind, rewind->image.words, NULL);
+        offset = rewind_allocate(rewind, size);
+    }
+    const bool stored_keyframe = keyframe || base < rewind->oldest;
+
+    memcpy(rewind->arena + offset, rewind->encoded, size);
+    *rewind_frame(rewind, rewind->next) = (struct RewindFrame){
+        .offset = offset,
+        .size = size,
+        .keyframe = stored_keyframe ? rewind->next : base,
+    };
+    rewind->arena_head = offset + size;
+    rewind->next++;
+}
+
+bool emulator_rewind_restore(struct Rewind *rewind, struct EmulatedSystem *emulated_system) {
+    if (rewind->next - rewind->oldest < 2) return false;
+
+    // The newest frame is the present; drop it and go back to the one before
+    rewind->next--;
+    rewind->arena_head = rewind_frame(rewind, rewind->next)->offset;
+    if (rewind->keyframe_sequence == rewind->next) rewind->keyframe_sequence = UINT64_MAX;
+
+    const struct RewindFrame *frame = rewind_frame(rewind, rewind->next - 1);
+    rewind_load_keyframe(rewind, frame->keyframe);
+    rewind->image = rewind->keyframe_image;
+    if (frame->keyframe != rewind->next - 1) rewind_decode(rewind->arena + frame->offset, frame->size, rewind->image.words);
+
+    // Input and the run state belong to the user, not to the past
+    struct EmulatedSystem *past = &rewind->image.emulated_system;
+    memcpy(past->keypad, emulated_system->keypad, sizeof past->keypad);
+    past->state = emulated_system->state;
+    *emulated_system = *past;
+    return true;
+}
+
+uint32_t emulator_rewind_frames(const struct Rewind *rewind) {
+    return (uint32_t)(rewind->next - rewind->oldest);
+}
+
+size_t emulator_rewind_memory_used(const struct Rewind *rewind) {
+    if (rewind->oldest == rewind->next) return 0;
+
+    const size_t tail = rewind->frames[rewind->oldest % rewind->max_frames].offset;
+    return rewind->arena_head > tail ? rewind->arena_head - tail : rewind->arena_size - tail + rewind->arena_head;
+}
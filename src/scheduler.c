@@ -0,0 +1,70 @@
+// Frame scheduler
+//
+// Frame k of a timeline is due at origin + k / 60 s. The deadline is computed from k every time instead of
+// adding a rounded frame duration, so it does not drift, and the sleep is absolute (TIMER_ABSTIME), so time
+// spent emulating and drawing does not add up either. A late front-end gets every frame it missed, up to
+// SCHEDULER_MAX_CATCH_UP; after a longer stall the timeline restarts instead of fast-forwarding through it.
+//
+// The timers step once per frame, so pacing frames also paces them; the fractional part of the instruction
+// budget is carried by emulator_update().
+
+#include "scheduler.h"
+
+#include <errno.h>
+#include <time.h> // clock_nanosleep()
+
+#define NS_PER_SECOND 1000000000u
+
+void emulator_scheduler_start(struct Scheduler *scheduler, uint64_t now_ns, uint64_t instructions_executed) {
+    emulator_scheduler_restart(scheduler, now_ns);
+    scheduler->window_start_ns = now_ns;
+    scheduler->window_instructions = instructions_executed;
+    scheduler->measured_instructions_per_second = 0.0;
+}
+
+void emulator_scheduler_restart(struct Scheduler *scheduler, uint64_t now_ns) {
+    scheduler->origin_ns = now_ns;
+    scheduler->frames = 0;
+}
+
+uint64_t emulator_scheduler_deadline(const struct Scheduler *scheduler, uint64_t frame) {
+    return scheduler->origin_ns + frame * NS_PER_SECOND / SCHEDULER_FRAME_RATE;
+}
+
+uint32_t emulator_scheduler_frames_due(struct Scheduler *scheduler, uint64_t now_ns) {
+    if (now_ns < scheduler->origin_ns) return 0;
+
+    // Frames whose deadline has passed, frame 0 included
+    const uint64_t reached = (now_ns - scheduler->origin_ns) * SCHEDULER_FRAME_RATE / NS_PER_SECOND + 1;
+    if (reached <= scheduler->frames) return 0;
+
+    const uint64_t due = reached - scheduler->frames;
+    if (due > SCHEDULER_MAX_CATCH_UP) {
+        emulator_scheduler_restart(scheduler, now_ns);
+        scheduler->frames = 1;
+        return SCHEDULER_MAX_CATCH_UP;
+    }
+
+    scheduler->frames = reached;
+    return (uint32_t)due;
+}
+
+void emulator_scheduler_wait(const struct Scheduler *scheduler) {
+    emulator_scheduler_sleep_until(emulator_scheduler_deadline(scheduler, scheduler->frames));
+}
+
+void emulator_scheduler_sleep_until(uint64_t deadline_ns) {
+    const struct timespec until = { .tv_sec = (time_t)(deadline_ns / NS_PER_SECOND), .tv_nsec = (long)(deadline_ns % NS_PER_SECOND) };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {}
+}
+
+bool emulator_scheduler_measure(struct Scheduler *scheduler, uint64_t now_ns, uint64_t instructions_executed) {
+    const uint64_t elapsed = now_ns - scheduler->window_start_ns;
+    if (elapsed < NS_PER_SECOND) return false;
+
+    scheduler->measured_instructions_per_second = (double)(instructions_executed - scheduler->window_instructions) * NS_PER_SECOND / elapsed;
+    scheduler->window_start_ns = now_ns;
+    scheduler->window_instructions = instructions_executed;
+    return true;
+}
@@ -0,0 +1,153 @@
+// Execution trace writer
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h> // clock_gettime()
+
+// Sleeps until a quarter of the ring is waiting, stop is set or TRACE_FLUSH_MS pass. Writes are batched this way
+// so that, on machines with few cores, the writer does not keep taking time from the emulator for tiny writes.
+static void trace_sleep(struct Trace *trace) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    while (!atomic_load_explicit(&trace->stop, memory_order_acquire)
+           && atomic_load_explicit(&trace->head, memory_order_acquire) - atomic_load_explicit(&trace->tail, memory_order_relaxed) < trace->capacity / 4) {
+        if (pthread_cond_timedwait(&trace->filled, &trace->lock, &deadline) == ETIMEDOUT) break;
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+// Writer thread: moves what is between tail and head to the file, in at most two chunks (ring wrap). After a
+// failed write the records are still consumed, so the emulator never waits on a writer that can not write.
+static void *trace_writer(void *argument) {
+    struct Trace *trace = argument;
+
+    for (;;) {
+        const bool stopping = atomic_load_explicit(&trace->stop, memory_order_acquire);
+        const uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+        if (head == tail && stopping) return NULL;
+
+        while (tail != head) {
+            const uint64_t start = tail & (trace->capacity - 1);
+            uint64_t count = head - tail;
+            if (count > trace->capacity - start) count = trace->capacity - start;
+
+            if (!trace->failed && fwrite(&trace->records[start], sizeof(struct TraceRecord), count, trace->file) != count) {
+                perror("trace: fwrite");
+                trace->failed = true;
+            }
+            tail += count;
+            atomic_store_explicit(&trace->tail, tail, memory_order_release);
+
+            pthread_mutex_lock(&trace->lock);
+            pthread_cond_signal(&trace->freed);
+            pthread_mutex_unlock(&trace->lock);
+        }
+        if (!stopping) trace_sleep(trace);
+    }
+}
+
+struct Trace *emulator_trace_open(const char *filename, uint64_t capacity) {
+    uint64_t rounded = 4;
+    while (rounded < capacity) rounded <<= 1;
+
+    struct Trace *trace = calloc(1, sizeof(struct Trace));
+    if (!trace) return NULL;
+    trace->capacity = rounded;
+    trace->next_wake = rounded / 4;
+    trace->records = malloc(rounded * sizeof(struct TraceRecord));
+    if (trace->records) memset(trace->records, 0, rounded * sizeof(struct TraceRecord)); // fault the pages in now, not while emulating
+    trace->file = fopen(filename, "wb");
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->stop, false);
+
+    bool synchronized = pthread_mutex_init(&trace->lock, NULL) == 0;
+    if (synchronized && pthread_cond_init(&trace->filled, NULL) != 0) {
+        pthread_mutex_destroy(&trace->lock);
+        synchronized = false;
+    }
+    if (synchronized && pthread_cond_init(&trace->freed, NULL) != 0) {
+        pthread_cond_destroy(&trace->filled);
+        pthread_mutex_destroy(&trace->lock);
+        synchronized = false;
+    }
+
+    const uint8_t header[8] = { 'T', 'C', '8', 'T', TRACE_VERSION, 0, sizeof(struct TraceRecord), 0 };
+    if (!synchronized || !trace->records || !trace->file || fwrite(header, sizeof header, 1, trace->file) != 1
+        || pthread_create(&trace->writer, NULL, trace_writer, trace) != 0) {
+        fprintf(stderr, "Could not start tracing to %s\n", filename);
+        if (synchronized) {
+            pthread_cond_destroy(&trace->freed);
+            pthread_cond_destroy(&trace->filled);
+            pthread_mutex_destroy(&trace->lock);
+        }
+        if (trace->file) fclose(trace->file);
+        free(trace->records);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+void emulator_trace_wait(struct Trace *trace) {
+    trace->stalls++;
+    pthread_mutex_lock(&trace->lock);
+    pthread_cond_signal(&trace->filled); // the writer may still be sleeping off its last batch
+    for (;;) {
+        // tail is stored before the writer takes the lock to signal, so no wake-up is missed
+        trace->known_tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+        if (trace->write_index - trace->known_tail < trace->capacity) break;
+        pthread_cond_wait(&trace->freed, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void emulator_trace_wake(struct Trace *trace) {
+    trace->next_wake += trace->capacity / 4;
+    pthread_mutex_lock(&trace->lock);
+    pthread_cond_signal(&trace->filled);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void emulator_trace_frame(struct Trace *trace, uint64_t frame, const struct EmulatedSystem *emulated_system) {
+    struct TraceRecord *record = emulator_trace_reserve(trace);
+
+    record->PC = TRACE_FRAME;
+    record->opcode = frame & 0xFFFF;
+    record->I = (frame >> 16) & 0xFFFF;
+    record->VX = emulated_system->delay_timer;
+    record->VF = emulated_system->sound_timer;
+    emulator_trace_commit(trace);
+}
+
+bool emulator_trace_close(struct Trace *trace) {
+    if (!trace) return true;
+
+    pthread_mutex_lock(&trace->lock);
+    atomic_store_explicit(&trace->stop, true, memory_order_release);
+    pthread_cond_signal(&trace->filled);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->writer, NULL);
+    pthread_cond_destroy(&trace->freed);
+    pthread_cond_destroy(&trace->filled);
+    pthread_mutex_destroy(&trace->lock);
+
+    bool ok = !trace->failed && !ferror(trace->file);
+    ok &= fclose(trace->file) == 0;
+    if (trace->stalls) fprintf(stderr, "trace: the emulator waited for the writer %llu times\n", (long long unsigned)trace->stalls);
+    free(trace->records);
+    free(trace);
+    return ok;
+}
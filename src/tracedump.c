@@ -0,0 +1,99 @@
+// Trace dumper: turns a binary trace written with --trace into text
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disassembler.h"
+#include "trace.h"
+
+// Registers an instruction writes, bit x for Vx (the trace stores VX and VF whatever the instruction)
+static uint16_t written_registers(uint16_t opcode) {
+    const uint16_t X = 1u << ((opcode >> 8) & 0x0F);
+
+    switch (opcode >> 12) {
+        case 0x6: case 0x7: case 0xC: return X;
+        case 0x8: return X | 0x8000;
+        case 0xD: return 0x8000;
+        case 0xF: return (opcode & 0xFF) == 0x07 || (opcode & 0xFF) == 0x0A ? X : 0;
+        default: return 0;
+    }
+}
+
+struct TraceReader {
+    FILE *file;
+    struct TraceRecord records[4096];
+    size_t count;
+    size_t next;
+};
+
+static bool trace_read(struct TraceReader *reader, struct TraceRecord *record) {
+    if (reader->next == reader->count) {
+        reader->count = fread(reader->records, sizeof(struct TraceRecord), sizeof reader->records / sizeof reader->records[0], reader->file);
+        reader->next = 0;
+        if (reader->count == 0) return false;
+    }
+    *record = reader->records[reader->next++];
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace_file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static struct TraceReader reader;
+    reader.file = fopen(argv[1], "rb");
+    if (!reader.file) {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t header[8];
+    if (fread(header, sizeof header, 1, reader.file) != 1 || memcmp(header, "TC8T", 4) != 0
+        || header[4] != TRACE_VERSION || header[6] != sizeof(struct TraceRecord)) {
+        fprintf(stderr, "%s is not a trace from this version\n", argv[1]);
+        fclose(reader.file);
+        return EXIT_FAILURE;
+    }
+
+    struct TraceRecord record;
+    while (trace_read(&reader, &record)) {
+        if (record.PC == TRACE_FRAME) {
+            printf("frame %lu  DT=%02X ST=%02X\n", (unsigned long)record.opcode | (unsigned long)record.I << 16, record.VX, record.VF);
+            continue;
+        }
+        if (record.PC == TRACE_MORE_VALUES) continue; // only expected right after register loads, handled there
+
+        char text[32];
+        emulator_disassemble(record.opcode, text, sizeof text);
+        printf("  %03X  %04X  %-18s  I=%03X", record.PC, record.opcode, text, record.I);
+
+        const uint8_t X = (record.opcode >> 8) & 0x0F;
+        const int last = emulator_trace_loaded_registers(record.opcode);
+        if (last >= 0) {
+            // 5XY3 only loads the registers between X and Y
+            const uint8_t Y = (record.opcode >> 4) & 0x0F;
+            const int low = (record.opcode & 0xF000) == 0x5000 ? (X < Y ? X : Y) : 0;
+            for (int first = 0; first <= last; first += 6) {
+                struct TraceRecord values;
+                if (!trace_read(&reader, &values) || values.PC != TRACE_MORE_VALUES) break;
+                const uint8_t *bytes = (const uint8_t *)&values + 2;
+                for (int x = first; x <= last && x < first + 6; x++)
+                    if (x >= low) printf("  V%X=%02X", x, bytes[x - first]);
+            }
+        }
+        else {
+            const uint16_t written = written_registers(record.opcode);
+            if (written & ~0x8000) printf("  V%X=%02X", X, record.VX);
+            if (written & 0x8000) printf("  VF=%02X", record.VF);
+        }
+        printf("\n");
+    }
+
+    const bool ok = !ferror(reader.file);
+    fclose(reader.file);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+// Phosphor "ghosting" effect
+//
+// Per channel: next = color + ((target - color) * rate) >> 7, with rate in 1/128 steps so the product fits
+// in 16 bits (SIMD lanes). When truncation stalls the fade one step short of the target, the channel snaps
+// to the target, so the screen eventually becomes static.
+
+#include "user_interface/ghosting.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GHOSTING_X86
+#endif
+
+static uint32_t emulator_ghosting_fixed_rate(float rate) {
+    if (rate <= 0.0f) return 0;
+    if (rate >= 1.0f) return 128;
+    return (uint32_t)(rate * 128 + 0.5f);
+}
+
+static uint32_t emulator_ghosting_lerp(uint32_t color, uint32_t target, int32_t rate) {
+    uint32_t result = 0;
+
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        const int32_t channel = (color >> shift) & 0xFF;
+        const int32_t target_channel = (target >> shift) & 0xFF;
+        int32_t next = channel + (((target_channel - channel) * rate) >> 7);
+
+        if (next == channel) next = target_channel;
+        result |= (uint32_t)next << shift;
+    }
+    return result;
+}
+
+uint64_t emulator_ghosting_step_scalar(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                       uint32_t width, uint32_t height, const uint32_t palette[4], float rate) {
+    const int32_t fixed_rate = emulator_ghosting_fixed_rate(rate);
+    const uint32_t words_per_row = width / 64;
+    uint64_t changed_rows = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t *color = &pixel_color[y * width + x];
+            const uint32_t word = y * words_per_row + x / 64, shift = 63 - x % 64;
+            const uint32_t index = ((display[word] >> shift) & 1) | (display2 ? ((display2[word] >> shift) & 1) << 1 : 0);
+            const uint32_t target = palette[index];
+
+            if (*color != target) {
+                *color = emulator_ghosting_lerp(*color, target, fixed_rate);
+                changed_rows |= (uint64_t)1 << y;
+            }
+        }
+    }
+    return changed_rows;
+}
+
+#ifdef GHOSTING_X86
+
+// 4 pixels at a time (SSE2 is part of x86-64)
+__attribute__((target("sse2")))
+static uint64_t emulator_ghosting_step_sse2(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                            uint32_t width, uint32_t height, const uint32_t palette[4], float rate) {
+    const __m128i fixed_rate = _mm_set1_epi16((int16_t)emulator_ghosting_fixed_rate(rate));
+    const __m128i color0 = _mm_set1_epi32((int32_t)palette[0]), color1 = _mm_set1_epi32((int32_t)palette[1]);
+    const __m128i color2 = _mm_set1_epi32((int32_t)palette[2]), color3 = _mm_set1_epi32((int32_t)palette[3]);
+    const __m128i lane_bits = _mm_set_epi32(1, 2, 4, 8); // lane 0 is the leftmost pixel (highest bit)
+    const __m128i zero = _mm_setzero_si128();
+    const uint32_t words_per_row = width / 64;
+    uint64_t changed_rows = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        __m128i row_changed = zero;
+
+        for (uint32_t x = 0; x < width; x += 4) {
+            __m128i *pixels = (__m128i *)&pixel_color[y * width + x];
+            const uint32_t word = y * words_per_row + x / 64;
+            const __m128i bits = _mm_set1_epi32((int32_t)((display[word] >> (60 - x % 64)) & 0xF));
+            const __m128i bits2 = _mm_set1_epi32(display2 ? (int32_t)((display2[word] >> (60 - x % 64)) & 0xF) : 0);
+            const __m128i lit = _mm_cmpeq_epi32(_mm_and_si128(bits, lane_bits), lane_bits);
+            const __m128i lit2 = _mm_cmpeq_epi32(_mm_and_si128(bits2, lane_bits), lane_bits);
+            const __m128i first = _mm_or_si128(_mm_and_si128(lit, color1), _mm_andnot_si128(lit, color0));
+            const __m128i second = _mm_or_si128(_mm_and_si128(lit, color3), _mm_andnot_si128(lit, color2));
+            const __m128i target = _mm_or_si128(_mm_and_si128(lit2, second), _mm_andnot_si128(lit2, first));
+            const __m128i color = _mm_loadu_si128(pixels);
+
+            // Widen channels to 16 bits: next = color + ((target - color) * rate) >> 7
+            const __m128i color_low = _mm_unpacklo_epi8(color, zero), color_high = _mm_unpackhi_epi8(color, zero);
+            const __m128i target_low = _mm_unpacklo_epi8(target, zero), target_high = _mm_unpackhi_epi8(target, zero);
+            const __m128i next_low = _mm_add_epi16(color_low, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(target_low, color_low), fixed_rate), 7));
+            const __m128i next_high = _mm_add_epi16(color_high, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(target_high, color_high), fixed_rate), 7));
+            __m128i next = _mm_packus_epi16(next_low, next_high);
+
+            // Snap stalled channels
+            const __m128i stalled = _mm_cmpeq_epi8(next, color);
+            next = _mm_or_si128(_mm_and_si128(stalled, target), _mm_andnot_si128(stalled, next));
+
+            row_changed = _mm_or_si128(row_changed, _mm_xor_si128(next, color));
+            _mm_storeu_si128(pixels, next);
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(row_changed, zero)) != 0xFFFF) changed_rows |= (uint64_t)1 << y;
+    }
+    return changed_rows;
+}
+
+// 8 pixels at a time
+__attribute__((target("avx2")))
+static uint64_t emulator_ghosting_step_avx2(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                            uint32_t width, uint32_t height, const uint32_t palette[4], float rate) {
+    const __m256i fixed_rate = _mm256_set1_epi16((int16_t)emulator_ghosting_fixed_rate(rate));
+    const __m256i color0 = _mm256_set1_epi32((int32_t)palette[0]), color1 = _mm256_set1_epi32((int32_t)palette[1]);
+    const __m256i color2 = _mm256_set1_epi32((int32_t)palette[2]), color3 = _mm256_set1_epi32((int32_t)palette[3]);
+    const __m256i lane_bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i zero = _mm256_setzero_si256();
+    const uint32_t words_per_row = width / 64;
+    uint64_t changed_rows = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        __m256i row_changed = zero;
+
+        for (uint32_t x = 0; x < width; x += 8) {
+            __m256i *pixels = (__m256i *)&pixel_color[y * width + x];
+            const uint32_t word = y * words_per_row + x / 64;
+            const __m256i bits = _mm256_set1_epi32((int32_t)((display[word] >> (56 - x % 64)) & 0xFF));
+            const __m256i bits2 = _mm256_set1_epi32(display2 ? (int32_t)((display2[word] >> (56 - x % 64)) & 0xFF) : 0);
+            const __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(bits, lane_bits), lane_bits);
+            const __m256i lit2 = _mm256_cmpeq_epi32(_mm256_and_si256(bits2, lane_bits), lane_bits);
+            const __m256i target = _mm256_blendv_epi8(_mm256_blendv_epi8(color0, color1, lit),
+                                                      _mm256_blendv_epi8(color2, color3, lit), lit2);
+            const __m256i color = _mm256_loadu_si256(pixels);
+
+            // unpack works inside each 128-bit half; packus undoes it the same way
+            const __m256i color_low = _mm256_unpacklo_epi8(color, zero), color_high = _mm256_unpackhi_epi8(color, zero);
+            const __m256i target_low = _mm256_unpacklo_epi8(target, zero), target_high = _mm256_unpackhi_epi8(target, zero);
+            const __m256i next_low = _mm256_add_epi16(color_low, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(target_low, color_low), fixed_rate), 7));
+            const __m256i next_high = _mm256_add_epi16(color_high, _mm256_srai_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(target_high, color_high), fixed_rate), 7));
+            __m256i next = _mm256_packus_epi16(next_low, next_high);
+
+            next = _mm256_blendv_epi8(next, target, _mm256_cmpeq_epi8(next, color));
+
+            row_changed = _mm256_or_si256(row_changed, _mm256_xor_si256(next, color));
+            _mm256_storeu_si256(pixels, next);
+        }
+
+        if (!_mm256_testz_si256(row_changed, row_changed)) changed_rows |= (uint64_t)1 << y;
+    }
+    return changed_rows;
+}
+
+#endif
+
+uint64_t emulator_ghosting_step(uint32_t *pixel_color, const uint64_t *display, const uint64_t *display2,
+                                uint32_t width, uint32_t height, const uint32_t palette[4], float rate) {
+#ifdef GHOSTING_X86
+    if (__builtin_cpu_supports("avx2"))
+        return emulator_ghosting_step_avx2(pixel_color, display, display2, width, height, palette, rate);
+    if (__builtin_cpu_supports("sse2"))
+        return emulator_ghosting_step_sse2(pixel_color, display, display2, width, height, palette, rate);
+#endif
+    return emulator_ghosting_step_scalar(pixel_color, display, display2, width, height, palette, rate);
+}
@@ -1,26 +1,11 @@
 #include "user_interface/sdl/interface.h"
-
-// efeito de "flick" de monitores antigos
-uint32_t emulator_user_interface_color_lerp(const uint32_t start_color, const uint32_t end_color, const float t) {
-    const uint8_t s_r = (start_color >> 24) & 0xFF;
-    const uint8_t s_g = (start_color >> 16) & 0xFF;
-    const uint8_t s_b = (start_color >> 8)  & 0xFF;
-    const uint8_t s_a = (start_color >> 0)  & 0xFF;
-
-    const uint8_t e_r = (end_color >> 24)   & 0xFF;
-    const uint8_t e_g = (end_color >> 16)   & 0xFF;
-    const uint8_t e_b = (end_color >> 8)    & 0xFF;
-    const uint8_t e_a = (end_color >> 0)    & 0xFF;
-
-    const uint8_t ret_r = ((1-t)*(s_r)) + (t*e_r);
-    const uint8_t ret_g = ((1-t)*(s_g)) + (t*e_g);
-    const uint8_t ret_b = ((1-t)*(s_b)) + (t*e_b);
-    const uint8_t ret_a = ((1-t)*(s_a)) + (t*e_a);
-
-    return (ret_r << 24) | (ret_g << 16) | (ret_b << 8) | (ret_a);
-}
+#include "user_interface/ghosting.h"
+#include "beeper.h"
+#include "headless.h" // emulator_headless_now_ns()
 
 void emulator_user_interface_destroy(struct UserInterface *user_interface) {
+    free(user_interface->texture_row);
+    SDL_DestroyTexture(user_interface->texture);
     SDL_DestroyRenderer(user_interface->renderer);
     SDL_DestroyWindow(user_interface->window);
     SDL_CloseAudioDevice(user_interface->dev);
@@ -38,43 +23,41 @@ void emulator_user_interface_clear_screen(struct UserInterface *user_interface)
     SDL_RenderClear(user_interface->renderer);
 }
 
+// Audio thread: plays what the emulation queued in the beeper (userdata), never touches the user interface
 void emulator_user_interface_audio_callback(void *userdata, uint8_t *stream, int len) {
-    struct UserInterface *user_interface = (struct UserInterface *)userdata;
-    
-    int16_t *audio_data = (int16_t *)stream;
-    static uint32_t running_sample_index = 0;
-    const int32_t square_wave_period = user_interface->audio_sample_rate / user_interface->square_wave_freq;
-    const int32_t half_square_wave_period = square_wave_period / 2;
-    
-    for (int i = 0; i < len/2; i++) {
-        audio_data[i] = ((running_sample_index / half_square_wave_period) % 2) ?
-                        user_interface->volume : -user_interface->volume;
-        
-        
-        running_sample_index = (running_sample_index + 1) % square_wave_period;
-    }
+    emulator_beeper_render((struct Beeper *)userdata, (int16_t *)stream, (size_t)len / sizeof(int16_t));
 }
 
-bool emulator_user_interface_initialize(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system) {
+// Fills configurable fields; may be overriden (e.g. by command line) before initialization
+void emulator_user_interface_set_defaults(struct UserInterface *user_interface) {
     *user_interface = (struct UserInterface){
-        .desired_window_width = 64,
-        .desired_window_height = 32,
+        .desired_window_width = DISPLAY_WIDTH / 2, // scale_factor applies to CHIP-8 pixels
+        .desired_window_height = DISPLAY_HEIGHT / 2,
         .fg_color = 0xFFFFFFFF,
         .bg_color = 0x000000FF,
+        .plane2_color = 0xFF6600FF,
+        .blend_color = 0x662200FF,
         .scale_factor = 20,
         .pixel_outlines = true,
         .square_wave_freq = 440,
         .audio_sample_rate = 44100,
+        .audio_buffer_samples = BEEPER_DEFAULT_BUFFER_SAMPLES,
         .volume = 3000,
         .color_lerp_rate = 0.7,
+        .idle_when_paused = true,
+        .idle_when_minimized = true,
+        .idle_when_unfocused = false,
+        .focused = true,
+        .fast_forward_multiplier = 8,
     };
+}
+
+bool emulator_user_interface_initialize(struct UserInterface *user_interface, struct EmulationThread *thread) {
+    struct Emulator *emulator = thread->emulator; // the thread is not running yet
 
     // Init pixels to bg color
-    memset(
-        &user_interface->pixel_color[0],
-        user_interface->bg_color,
-        sizeof user_interface->pixel_color
-    );
+    for (uint32_t i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++)
+        user_interface->pixel_color[i] = user_interface->bg_color;
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
         SDL_Log("Could not Initialize SDL: %s\n", SDL_GetError());
@@ -100,13 +83,47 @@ bool emulator_user_interface_initialize(struct UserInterface *user_interface, st
         return false;
     }
 
+    // One texel per hi-res pixel (2x2 per CHIP8 pixel), stretched by the renderer; outlines need the scaled resolution
+    user_interface->texture_scale = user_interface->pixel_outlines && user_interface->scale_factor > 1
+                                    ? user_interface->scale_factor / 2 : 1;
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    user_interface->texture = SDL_CreateTexture(user_interface->renderer,
+                                                SDL_PIXELFORMAT_RGBA8888, // same layout as pixel_color (0xRRGGBBAA)
+                                                SDL_TEXTUREACCESS_STREAMING,
+                                                DISPLAY_WIDTH * user_interface->texture_scale,
+                                                DISPLAY_HEIGHT * user_interface->texture_scale);
+
+    if (!user_interface->texture) {
+        SDL_Log("Could not initialize texture: %s\n", SDL_GetError());
+        return false;
+    }
+
+    user_interface->texture_row = malloc(sizeof(uint32_t) * DISPLAY_WIDTH * user_interface->texture_scale * 2 * user_interface->texture_scale);
+    if (!user_interface->texture_row) {
+        SDL_Log("Could not allocate texture row\n");
+        return false;
+    }
+    user_interface->texture_valid = false;
+
+    // The emulation pushes the sound state of each frame, the callback synthesizes it
+    emulator->beeper = emulator_beeper_create(user_interface->audio_sample_rate, user_interface->square_wave_freq,
+                                              user_interface->volume, user_interface->audio_buffer_samples);
+    if (!emulator->beeper) {
+        SDL_Log("Could not allocate the beeper\n");
+        return false;
+    }
+    user_interface->beeper = emulator->beeper;
+    emulator_beeper_set_muted(emulator->beeper, user_interface->fast_forward);
+    atomic_store_explicit(&thread->controls.fast_forward, user_interface->fast_forward, memory_order_relaxed);
+    atomic_store_explicit(&thread->controls.fast_forward_multiplier, user_interface->fast_forward_multiplier, memory_order_relaxed);
+
     user_interface->want = (SDL_AudioSpec){
-        .freq = 44100,
-        .format = AUDIO_S16LSB,
+        .freq = (int)user_interface->audio_sample_rate,
+        .format = AUDIO_S16SYS,
         .channels = 1,
-        .samples = 512,
+        .samples = (Uint16)user_interface->audio_buffer_samples,
         .callback = emulator_user_interface_audio_callback,
-        .userdata = emulated_system,
+        .userdata = emulator->beeper,
     };
 
     user_interface->dev = SDL_OpenAudioDevice(NULL, 0, &user_interface->want, &user_interface->have, 0);
@@ -121,69 +138,87 @@ bool emulator_user_interface_initialize(struct UserInterface *user_interface, st
         return false;
     }
 
+    // Silence is synthesized while the sound timer is off; the device is only paused along with the emulation
+    SDL_PauseAudioDevice(user_interface->dev, 0);
+    user_interface->audio_paused = false;
+
+    emulator_user_interface_clear_screen(user_interface);
+
     return true;
 }
 
-void emulator_user_interface_draw(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system) {
-    uint64_t current_moment = SDL_GetTicks64();
-    SDL_Rect rect;
-    uint32_t bg_color = user_interface->bg_color;
-
-    if (current_moment < user_interface->expected_moment_to_draw)
-    { SDL_Delay(user_interface->expected_moment_to_draw - current_moment); }
-
-    rect = (SDL_Rect){.x = 0, .y = 0, .w = user_interface->scale_factor, .h = user_interface->scale_factor};
-    const uint8_t bg_r = (bg_color >> 24) & 0xFF;
-    const uint8_t bg_g = (bg_color >> 16) & 0xFF;
-    const uint8_t bg_b = (bg_color >>  8) & 0xFF;
-    const uint8_t bg_a = (bg_color >>  0) & 0xFF;
-
-    for (uint32_t i = 0; i < sizeof emulated_system->display; i++) {
-        rect.x = (i % user_interface->desired_window_width) * user_interface->scale_factor;
-        rect.y = (i / user_interface->desired_window_width) * user_interface->scale_factor;
-
-        if (emulated_system->display[i]) {
-            if (user_interface->pixel_color[i] != user_interface->fg_color) {
-                user_interface->pixel_color[i] = emulator_user_interface_color_lerp(
-                    user_interface->pixel_color[i], 
-                    user_interface->fg_color, 
-                    user_interface->color_lerp_rate
-                );
+// Writes the colors of display row y into the texture (scale x scale texels per pixel, twice as many in low resolution)
+static void emulator_user_interface_upload_row(struct UserInterface *user_interface, const struct FrameSnapshot *frame, uint32_t y) {
+    const uint32_t scale = user_interface->texture_scale * (frame->hires ? 1 : 2);
+    const uint32_t width = frame->hires ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+    const uint32_t pitch = DISPLAY_WIDTH * user_interface->texture_scale;
+    uint32_t *texels = user_interface->texture_row;
+
+    for (uint32_t x = 0; x < width; x++) {
+        const uint32_t color = user_interface->pixel_color[y * DISPLAY_WIDTH + x];
+        const uint32_t shift = 63 - x % 64;
+        const bool lit = ((frame->display[0][y][x / 64] | frame->display[1][y][x / 64]) >> shift) & 1;
+        const bool outlined = user_interface->texture_scale > 1 && lit;
+
+        for (uint32_t row = 0; row < scale; row++) {
+            for (uint32_t column = 0; column < scale; column++) {
+                const bool border = row == 0 || column == 0 || row == scale - 1 || column == scale - 1;
+                texels[row * pitch + x * scale + column] = outlined && border ? user_interface->bg_color : color;
             }
+        }
+    }
 
-            const uint8_t r = (user_interface->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (user_interface->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (user_interface->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (user_interface->pixel_color[i] >>  0) & 0xFF;
-
-            SDL_SetRenderDrawColor(user_interface->renderer, r, g, b, a);
-            SDL_RenderFillRect(user_interface->renderer, &rect);
-        
-            if (user_interface->pixel_outlines) {
-                SDL_SetRenderDrawColor(user_interface->renderer, bg_r, bg_g, bg_b, bg_a);
-                SDL_RenderDrawRect(user_interface->renderer, &rect);
-            }
+    const SDL_Rect rect = {.x = 0, .y = y * scale, .w = pitch, .h = scale};
+    SDL_UpdateTexture(user_interface->texture, &rect, texels, pitch * sizeof(uint32_t));
+}
 
-        } else {
-            if (user_interface->pixel_color[i] != user_interface->bg_color) {
-                // Lerp
-                user_interface->pixel_color[i] = emulator_user_interface_color_lerp(
-                    user_interface->pixel_color[i], 
-                    user_interface->bg_color, 
-                    user_interface->color_lerp_rate
-                );
-            }
+static void emulator_user_interface_draw(struct UserInterface *user_interface, const struct FrameSnapshot *frame) {
+    uint32_t dirty_rows = 0;
 
-            const uint8_t r = (user_interface->pixel_color[i] >> 24) & 0xFF;
-            const uint8_t g = (user_interface->pixel_color[i] >> 16) & 0xFF;
-            const uint8_t b = (user_interface->pixel_color[i] >>  8) & 0xFF;
-            const uint8_t a = (user_interface->pixel_color[i] >>  0) & 0xFF;
+    // efeito de "flick" de monitores antigos, one vectorized pass over the whole frame
+    // (in low resolution the unused part of the display is clear, so it stays at bg_color)
+    const uint32_t palette[4] = {
+        user_interface->bg_color, user_interface->fg_color, user_interface->plane2_color, user_interface->blend_color,
+    };
+    const uint64_t fading_rows = emulator_ghosting_step(user_interface->pixel_color, frame->display[0][0],
+                                                        frame->display[1][0], DISPLAY_WIDTH, DISPLAY_HEIGHT,
+                                                        palette, user_interface->color_lerp_rate);
+
+    // A resolution change redraws everything
+    if (frame->hires != user_interface->drawn_hires) {
+        user_interface->texture_valid = false;
+        user_interface->drawn_hires = frame->hires;
+    }
 
-            SDL_SetRenderDrawColor(user_interface->renderer, r, g, b, a);
-            SDL_RenderFillRect(user_interface->renderer, &rect);
+    const uint32_t height = frame->hires ? DISPLAY_HEIGHT : DISPLAY_HEIGHT / 2;
+    for (uint32_t y = 0; y < height; y++) {
+        // A row is uploaded when its pixels changed or when some of its colors are still fading
+        bool dirty = !user_interface->texture_valid || ((fading_rows >> y) & 1);
+        for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+            dirty |= memcmp(frame->display[plane][y], user_interface->drawn_display[plane][y], sizeof frame->display[plane][y]) != 0;
+
+        if (dirty) {
+            emulator_user_interface_upload_row(user_interface, frame, y);
+            for (uint32_t plane = 0; plane < DISPLAY_PLANES; plane++)
+                memcpy(user_interface->drawn_display[plane][y], frame->display[plane][y], sizeof frame->display[plane][y]);
+            dirty_rows++;
         }
     }
-    SDL_RenderPresent(user_interface->renderer);
+    user_interface->texture_valid = true;
+
+    // Static display and no fading: the previous frame is still on screen
+    if (dirty_rows > 0) {
+        SDL_RenderCopy(user_interface->renderer, user_interface->texture, NULL, NULL);
+        SDL_RenderPresent(user_interface->renderer);
+    }
+
+    // Measured against configured speed, once a second
+    if (frame->measured_instructions_per_second != user_interface->shown_instructions_per_second) {
+        char title[64];
+        snprintf(title, sizeof title, "EMULADOR CHIP8 - %.0f/%u IPS", frame->measured_instructions_per_second, frame->instructions_per_second);
+        SDL_SetWindowTitle(user_interface->window, title);
+        user_interface->shown_instructions_per_second = frame->measured_instructions_per_second;
+    }
 }
 
 /*
@@ -193,22 +228,59 @@ CHIP8 Keypad  QWERTY
 789E          asdf
 A0BF          zxcv
 */
+static int emulator_user_interface_keypad_key(SDL_Keycode key) {
+  switch (key) {
+      case SDLK_1: return 0x1;
+      case SDLK_2: return 0x2;
+      case SDLK_3: return 0x3;
+      case SDLK_4: return 0xC;
+
+      case SDLK_q: return 0x4;
+      case SDLK_w: return 0x5;
+      case SDLK_e: return 0x6;
+      case SDLK_r: return 0xD;
+
+      case SDLK_a: return 0x7;
+      case SDLK_s: return 0x8;
+      case SDLK_d: return 0x9;
+      case SDLK_f: return 0xE;
+
+      case SDLK_z: return 0xA;
+      case SDLK_x: return 0x0;
+      case SDLK_c: return 0xB;
+      case SDLK_v: return 0xF;
+
+      default: return -1;
+  }
+}
+
+static void emulator_user_interface_set_keypad(struct UserInterface *user_interface, struct EmulationControls *controls, uint16_t keypad) {
+  user_interface->keypad = keypad;
+  atomic_store_explicit(&controls->input.keypad, keypad, memory_order_relaxed);
+}
+
+static void emulator_user_interface_handle_keyboard_event_key_down(struct UserInterface *user_interface, struct EmulationControls *controls, SDL_Keycode key) {
+  const int keypad_key = emulator_user_interface_keypad_key(key);
+  if (keypad_key >= 0) {
+      // Latency is measured from the first key down, not from the repeats
+      if (controls->input.measure_latency && !(user_interface->keypad & 1u << keypad_key))
+          atomic_store_explicit(&controls->input.pressed_ns[keypad_key], emulator_headless_now_ns(), memory_order_relaxed);
+      emulator_user_interface_set_keypad(user_interface, controls, user_interface->keypad | 1u << keypad_key);
+      return;
+  }
 
-void emulator_user_interface_handle_keyboard_event_key_down(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system, SDL_Keycode key) {
   switch (key) {
       case SDLK_ESCAPE:
           // Escape key; Exit window & End program
-          emulated_system->state = QUIT;
+          atomic_store_explicit(&controls->quit, true, memory_order_release);
           break;
           
       case SDLK_SPACE:
           // Space bar
-          if (emulated_system->state == RUNNING) {
-              emulated_system->state = PAUSE;  // Pause
-              puts("==== PAUSED ====");
-          } else {
-              emulated_system->state = RUNNING; // Resume
-          }
+          user_interface->paused = !user_interface->paused;
+          atomic_store_explicit(&controls->paused, user_interface->paused, memory_order_relaxed);
+          emulator_controls_wake(controls);
+          if (user_interface->paused) puts("==== PAUSED ====");
           break;
 
       case SDLK_EQUALS:
@@ -232,6 +304,7 @@ void emulator_user_interface_handle_keyboard_event_key_down(struct UserInterface
           // 'o': Decrease Volume
           if (user_interface->volume > 0)
               user_interface->volume -= 500;
+          emulator_beeper_set_volume(user_interface->beeper, user_interface->volume);
           break;
 
       case SDLK_p:
@@ -240,99 +313,149 @@ void emulator_user_interface_handle_keyboard_event_key_down(struct UserInterface
               //emulator->user_interface->volume += 500;
           break;
 
-      // Save state
+      // Fast-forward on/off
+      case SDLK_TAB:
+          user_interface->fast_forward = !user_interface->fast_forward;
+          atomic_store_explicit(&controls->fast_forward, user_interface->fast_forward, memory_order_relaxed);
+          emulator_beeper_set_muted(user_interface->beeper, user_interface->fast_forward);
+          if (!user_interface->fast_forward) puts("Fast-forward off");
+          else if (user_interface->fast_forward_multiplier == 0) puts("Fast-forward on (uncapped)");
+          else printf("Fast-forward on (%ux)\n", user_interface->fast_forward_multiplier);
+          break;
+
+      // Rewind while held
+      case SDLK_BACKSPACE:
+          user_interface->rewinding = true;
+          atomic_store_explicit(&controls->rewinding, true, memory_order_relaxed);
+          emulator_controls_wake(controls);
+          break;
+
+      // Save and load state, done by the emulation thread between frames
       case SDLK_F5:
-          if (emulated_save_state(emulated_system, "save_state.bin")) {
-              puts("State saved successfully.");
-          } else {
-              puts("Failed to save state.");
-          }
+          atomic_store_explicit(&controls->save_state, true, memory_order_release);
+          emulator_controls_wake(controls);
           break;
 
-      // Load state
       case SDLK_F9:
-          if (emulated_load_state(emulated_system, "save_state.bin")) {
-              puts("State loaded successfully.");
-          } else {
-              puts("Failed to load state.");
-          }
+          atomic_store_explicit(&controls->load_state, true, memory_order_release);
+          emulator_controls_wake(controls);
           break;
 
-      // Map qwerty keys to CHIP8 keypad
-      case SDLK_1: emulated_system->keypad[0x1] = true; break;
-      case SDLK_2: emulated_system->keypad[0x2] = true; break;
-      case SDLK_3: emulated_system->keypad[0x3] = true; break;
-      case SDLK_4: emulated_system->keypad[0xC] = true; break;
+      default: break;
+  }
+}
 
-      case SDLK_q: emulated_system->keypad[0x4] = true; break;
-      case SDLK_w: emulated_system->keypad[0x5] = true; break;
-      case SDLK_e: emulated_system->keypad[0x6] = true; break;
-      case SDLK_r: emulated_system->keypad[0xD] = true; break;
+static void emulator_user_interface_handle_keyboard_event_key_up(struct UserInterface *user_interface, struct EmulationControls *controls, SDL_Keycode key) {
+  const int keypad_key = emulator_user_interface_keypad_key(key);
+  if (keypad_key >= 0) emulator_user_interface_set_keypad(user_interface, controls, user_interface->keypad & ~(1u << keypad_key));
 
-      case SDLK_a: emulated_system->keypad[0x7] = true; break;
-      case SDLK_s: emulated_system->keypad[0x8] = true; break;
-      case SDLK_d: emulated_system->keypad[0x9] = true; break;
-      case SDLK_f: emulated_system->keypad[0xE] = true; break;
+  if (key == SDLK_BACKSPACE) {
+      user_interface->rewinding = false;
+      atomic_store_explicit(&controls->rewinding, false, memory_order_relaxed);
+  }
+}
 
-      case SDLK_z: emulated_system->keypad[0xA] = true; break;
-      case SDLK_x: emulated_system->keypad[0x0] = true; break;
-      case SDLK_c: emulated_system->keypad[0xB] = true; break;
-      case SDLK_v: emulated_system->keypad[0xF] = true; break;
+bool emulator_user_interface_is_idle(const struct UserInterface *user_interface) {
+  if (user_interface->rewinding) return false;
 
-      default: break;
-  }
+  return (user_interface->idle_when_paused && user_interface->paused)
+         || (user_interface->idle_when_minimized && user_interface->minimized)
+         || (user_interface->idle_when_unfocused && !user_interface->focused);
 }
 
-void emulator_user_interface_handle_keyboard_event_key_up(struct EmulatedSystem *emulated_system, SDL_Keycode key) {
-  switch (key) {
-      // qwerty to CHIP8 keypad
-      case SDLK_1: emulated_system->keypad[0x1] = false; break;
-      case SDLK_2: emulated_system->keypad[0x2] = false; break;
-      case SDLK_3: emulated_system->keypad[0x3] = false; break;
-      case SDLK_4: emulated_system->keypad[0xC] = false; break;
-
-      case SDLK_q: emulated_system->keypad[0x4] = false; break;
-      case SDLK_w: emulated_system->keypad[0x5] = false; break;
-      case SDLK_e: emulated_system->keypad[0x6] = false; break;
-      case SDLK_r: emulated_system->keypad[0xD] = false; break;
-
-      case SDLK_a: emulated_system->keypad[0x7] = false; break;
-      case SDLK_s: emulated_system->keypad[0x8] = false; break;
-      case SDLK_d: emulated_system->keypad[0x9] = false; break;
-      case SDLK_f: emulated_system->keypad[0xE] = false; break;
-
-      case SDLK_z: emulated_system->keypad[0xA] = false; break;
-      case SDLK_x: emulated_system->keypad[0x0] = false; break;
-      case SDLK_c: emulated_system->keypad[0xB] = false; break;
-      case SDLK_v: emulated_system->keypad[0xF] = false; break;
+static void emulator_user_interface_handle_event(struct UserInterface *user_interface, struct EmulationControls *controls, const SDL_Event *event) {
+  switch (event->type) {
+      case SDL_QUIT:
+          // Exit window; End program
+          atomic_store_explicit(&controls->quit, true, memory_order_release); // Will exit main emulator loop
+          break;
 
-      default: break;
+      case SDL_WINDOWEVENT:
+          switch (event->window.event) {
+              case SDL_WINDOWEVENT_EXPOSED:
+                  // The window contents may have been lost, the next draw must present again
+                  user_interface->texture_valid = false;
+                  break;
+
+              case SDL_WINDOWEVENT_MINIMIZED:
+                  user_interface->minimized = true;
+                  break;
+
+              case SDL_WINDOWEVENT_RESTORED:
+              case SDL_WINDOWEVENT_MAXIMIZED:
+              case SDL_WINDOWEVENT_SHOWN:
+                  user_interface->minimized = false;
+                  break;
+
+              case SDL_WINDOWEVENT_FOCUS_GAINED:
+                  user_interface->focused = true;
+                  break;
+
+              case SDL_WINDOWEVENT_FOCUS_LOST:
+                  // Key releases will not be seen anymore
+                  user_interface->focused = false;
+                  user_interface->rewinding = false;
+                  atomic_store_explicit(&controls->rewinding, false, memory_order_relaxed);
+                  emulator_user_interface_set_keypad(user_interface, controls, 0);
+                  break;
+
+              default:
+                  break;
+          }
+          break;
+
+      case SDL_KEYDOWN:
+          emulator_user_interface_handle_keyboard_event_key_down(user_interface, controls, event->key.keysym.sym);
+          break;
+
+      case SDL_KEYUP:
+          emulator_user_interface_handle_keyboard_event_key_up(user_interface, controls, event->key.keysym.sym);
+          break;
+
+      default:
+          break;
   }
 }
 
-void emulator_user_interface_update(struct UserInterface *user_interface, struct EmulatedSystem *emulated_system) {
+void emulator_user_interface_update(struct UserInterface *user_interface, struct EmulationThread *thread) {
+  struct EmulationControls *controls = &thread->controls;
   SDL_Event event;
+  bool fresh;
+
+  if (emulator_user_interface_is_idle(user_interface)) {
+      // Sleep until something happens; the timeout only bounds how long a quit request can wait
+      if (SDL_WaitEventTimeout(&event, 250))
+          emulator_user_interface_handle_event(user_interface, controls, &event);
+      while (SDL_PollEvent(&event))
+          emulator_user_interface_handle_event(user_interface, controls, &event);
+  }
+  else {
+      while (SDL_PollEvent(&event))
+          emulator_user_interface_handle_event(user_interface, controls, &event);
+  }
 
-  while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-          case SDL_QUIT:
-              // Exit window; End program
-              emulated_system->state = QUIT; // Will exit main emulator loop
-              break;
+  const bool idle = emulator_user_interface_is_idle(user_interface);
+  if (atomic_exchange_explicit(&controls->idle, idle, memory_order_relaxed) != idle) emulator_controls_wake(controls);
 
-          case SDL_KEYDOWN:
-              emulator_user_interface_handle_keyboard_event_key_down(user_interface, emulated_system, event.key.keysym.sym);
-              break;
+  // Nothing is emulated while paused or idle (a rewind runs even then, silently), so the audio callback stops too
+  const bool silent = idle || (user_interface->paused && !user_interface->rewinding);
+  if (silent != user_interface->audio_paused) {
+      SDL_PauseAudioDevice(user_interface->dev, silent);
+      user_interface->audio_paused = silent;
+  }
 
-          case SDL_KEYUP:
-              emulator_user_interface_handle_keyboard_event_key_up(emulated_system, event.key.keysym.sym);
-              break;
+  // The newest frame the emulation published; while idle, only to redraw after an expose
+  const struct FrameSnapshot *frame = emulator_thread_latest_frame(thread, &fresh);
+  if (frame && (!idle || !user_interface->texture_valid)) emulator_user_interface_draw(user_interface, frame);
+}
 
-          default:
-              break;
-      }
-  }
+void emulator_user_interface_wait_events(struct UserInterface *user_interface, struct EmulationThread *thread, uint64_t deadline_ns) {
+  SDL_Event event;
 
-  emulator_user_interface_draw(user_interface, emulated_system);
-  SDL_PauseAudioDevice(user_interface->dev, !user_interface->should_play_sound); // Maybe pause sound
-}
\ No newline at end of file
+  for (uint64_t now = emulator_headless_now_ns(); now < deadline_ns; now = emulator_headless_now_ns()) {
+      const int timeout_ms = (int)((deadline_ns - now) / 1000000);
+      if (timeout_ms == 0) break; // the rest is slept by the caller, more precisely
+      if (SDL_WaitEventTimeout(&event, timeout_ms))
+          emulator_user_interface_handle_event(user_interface, &thread->controls, &event);
+  }
+}
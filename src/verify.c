@@ -0,0 +1,250 @@
+// Lockstep verification
+
+#include "verify.h"
+#include "disassembler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct VerifiedInstruction {
+    uint16_t PC;
+    uint16_t opcode;
+};
+
+// Everything an instruction can change, but the keypad (an input) and the XO-CHIP audio state
+static bool verify_same(const struct Emulator *emulator, const struct Emulator *reference) {
+    const struct EmulatedSystem *a = &emulator->emulated_system, *b = &reference->emulated_system;
+
+    return a->state == b->state && a->PC == b->PC && a->I == b->I && memcmp(a->V, b->V, sizeof a->V) == 0
+           && a->stack_depth == b->stack_depth && memcmp(a->stack, b->stack, a->stack_depth * sizeof a->stack[0]) == 0
+           && a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer && a->awaited_key == b->awaited_key
+           && a->hires == b->hires && a->planes == b->planes && memcmp(a->display, b->display, sizeof a->display) == 0
+           && memcmp(a->ram, b->ram, emulator_ram_size(emulator)) == 0 && a->random_state == b->random_state
+           && emulator->instructions_executed == reference->instructions_executed;
+}
+
+static void verify_report_value(FILE *output, const char *name, uint64_t optimized, uint64_t reference, int digits) {
+    fprintf(output, "%c %-14s %0*llX %*s %0*llX\n", optimized == reference ? ' ' : '*', name,
+            digits, (long long unsigned)optimized, 16 - digits, "", digits, (long long unsigned)reference);
+}
+
+static void verify_report_stack(FILE *output, const struct EmulatedSystem *emulated_system, const char *name) {
+    fprintf(output, "  stack (%s):", name);
+    for (uint8_t i = 0; i < emulated_system->stack_depth && i < STACK_SIZE; i++) fprintf(output, " %03X", emulated_system->stack[i]);
+    fprintf(output, "\n");
+}
+
+// First offset where two blocks differ, -1 when they do not
+static long verify_first_difference(const uint8_t *a, const uint8_t *b, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        if (a[i] != b[i]) return (long)i;
+    return -1;
+}
+
+static void verify_report(FILE *output, const struct Emulator *emulator, const struct Emulator *reference,
+                          const struct VerifiedInstruction *listed, uint64_t run, uint64_t frame) {
+    const struct EmulatedSystem *a = &emulator->emulated_system, *b = &reference->emulated_system;
+    const uint32_t ram_size = emulator_ram_size(emulator);
+    char text[32];
+
+    fprintf(output, "verify: the machines differ in frame %llu, after the reference's instruction %llu\n",
+            (long long unsigned)frame, (long long unsigned)reference->instructions_executed);
+    fprintf(output, "instructions run since they last agreed (%llu, the diverging one is among them):\n", (long long unsigned)run);
+    if (run > VERIFY_LISTED_INSTRUCTIONS) fprintf(output, "  ...\n");
+    for (uint64_t i = run > VERIFY_LISTED_INSTRUCTIONS ? run - VERIFY_LISTED_INSTRUCTIONS : 0; i < run; i++) {
+        const struct VerifiedInstruction *instruction = &listed[i % VERIFY_LISTED_INSTRUCTIONS];
+        emulator_disassemble(instruction->opcode, text, sizeof text);
+        fprintf(output, "  %04X: %04X  %s\n", instruction->PC, instruction->opcode, text);
+    }
+
+    fprintf(output, "\n  %-14s %-16s %s\n", "", emulator->cpu == CPU_JIT ? "jit" : "interpreter", "reference");
+    verify_report_value(output, "instructions", emulator->instructions_executed, reference->instructions_executed, 16);
+    verify_report_value(output, "state", a->state, b->state, 1);
+    verify_report_value(output, "PC", a->PC, b->PC, 4);
+    verify_report_value(output, "I", a->I, b->I, 4);
+    for (int x = 0; x < 16; x++) {
+        char name[4];
+        snprintf(name, sizeof name, "V%X", x);
+        verify_report_value(output, name, a->V[x], b->V[x], 2);
+    }
+    verify_report_value(output, "delay timer", a->delay_timer, b->delay_timer, 2);
+    verify_report_value(output, "sound timer", a->sound_timer, b->sound_timer, 2);
+    verify_report_value(output, "awaited key", a->awaited_key, b->awaited_key, 2);
+    verify_report_value(output, "stack depth", a->stack_depth, b->stack_depth, 2);
+    verify_report_value(output, "hires", a->hires, b->hires, 1);
+    verify_report_value(output, "planes", a->planes, b->planes, 1);
+    verify_report_value(output, "RAM CRC-32", emulated_crc32(a->ram, ram_size), emulated_crc32(b->ram, ram_size), 8);
+    verify_report_value(output, "display hash", emulated_display_hash(a), emulated_display_hash(b), 16);
+    verify_report_stack(output, a, emulator->cpu == CPU_JIT ? "jit" : "interpreter");
+    verify_report_stack(output, b, "reference");
+
+    const long ram_difference = verify_first_difference(a->ram, b->ram, ram_size);
+    if (ram_difference >= 0)
+        fprintf(output, "  first RAM difference at %04lX: %02X, reference %02X\n", ram_difference, a->ram[ram_difference], b->ram[ram_difference]);
+    const long display_difference = verify_first_difference((const uint8_t *)a->display, (const uint8_t *)b->display, sizeof a->display);
+    if (display_difference >= 0) {
+        const long row = display_difference / (long)sizeof a->display[0][0] % DISPLAY_HEIGHT;
+        fprintf(output, "  first display difference in row %ld of plane %ld\n", row, display_difference / (long)sizeof a->display[0]);
+    }
+}
+
+// Where the machines last agreed, enough to replay from there
+struct VerifySnapshot {
+    struct EmulatedSystem emulated_system;
+    uint64_t instructions_executed;
+    uint64_t instructions_skipped;
+    uint64_t frame_instructions_left;
+    uint8_t idle_loop_length;
+};
+
+enum { VERIFY_AGREED, VERIFY_MIDDLE = 2, VERIFY_DIVERGED = 4, VERIFY_SNAPSHOTS = 6 }; // pairs: emulator, reference
+
+static void verify_take(struct VerifySnapshot *snapshot, const struct Emulator *emulator) {
+    snapshot->emulated_system = emulator->emulated_system;
+    snapshot->instructions_executed = emulator->instructions_executed;
+    snapshot->instructions_skipped = emulator->instructions_skipped;
+    snapshot->frame_instructions_left = emulator->frame_instructions_left;
+    snapshot->idle_loop_length = emulator->idle_loop_length;
+}
+
+static void verify_take_both(struct VerifySnapshot *pair, const struct Emulator *emulator, const struct Emulator *reference) {
+    verify_take(&pair[0], emulator);
+    verify_take(&pair[1], reference);
+}
+
+// Also drops the decoded and compiled code, which may have been built from RAM the machine no longer holds
+static void verify_restore(struct Emulator *emulator, const struct VerifySnapshot *snapshot) {
+    emulator_restore_system(emulator, &snapshot->emulated_system);
+    emulator->instructions_executed = snapshot->instructions_executed;
+    emulator->instructions_skipped = snapshot->instructions_skipped;
+    emulator->frame_instructions_left = snapshot->frame_instructions_left;
+    emulator->idle_loop_length = snapshot->idle_loop_length;
+}
+
+static void verify_restore_both(const struct VerifySnapshot *pair, struct Emulator *emulator, struct Emulator *reference) {
+    verify_restore(emulator, &pair[0]);
+    verify_restore(reference, &pair[1]);
+}
+
+// Gives the emulator a budget of count instructions, run the way its engine runs them (superinstructions, compiled
+// blocks, idle loops skipped), then steps the reference through as many as the emulator retired. The last ones are
+// listed; returns how many the reference ran.
+static uint64_t verify_step(struct Emulator *emulator, struct Emulator *reference, uint64_t count, struct VerifiedInstruction *listed) {
+    const uint64_t before = emulator->instructions_executed;
+    emulator_run_instructions(emulator, count);
+    const uint64_t retired = emulator->instructions_executed - before;
+
+    uint64_t run = 0;
+    for (; run < retired && reference->emulated_system.state != QUIT; run++) {
+        const struct EmulatedSystem *chip8 = &reference->emulated_system;
+        listed[run % VERIFY_LISTED_INSTRUCTIONS] = (struct VerifiedInstruction){
+            .PC = chip8->PC, .opcode = chip8->ram[chip8->PC] << 8 | chip8->ram[(chip8->PC + 1) & RAM_MASK],
+        };
+        emulator_emulate_instruction_reference(reference);
+    }
+    reference->instructions_executed += run;
+    reference->frame_instructions_left = emulator->frame_instructions_left;
+    return run;
+}
+
+// The machines agreed at snapshots[VERIFY_AGREED] and differ budget instructions later. Replays from there with
+// halved budgets, down to one instruction, or to the smallest window that only diverges when the engine runs it at
+// once (a superinstruction or compiled block across the halves). Leaves the machines after that window; returns
+// its length.
+static uint64_t verify_bisect(struct Emulator *emulator, struct Emulator *reference, struct VerifySnapshot *snapshots,
+                              uint64_t budget, struct VerifiedInstruction *listed) {
+    while (budget > 1) {
+        const uint64_t half = budget / 2;
+
+        verify_restore_both(&snapshots[VERIFY_AGREED], emulator, reference);
+        verify_step(emulator, reference, half, listed);
+        if (!verify_same(emulator, reference)) {
+            budget = half;
+            continue;
+        }
+
+        verify_take_both(&snapshots[VERIFY_MIDDLE], emulator, reference);
+        verify_step(emulator, reference, budget - half, listed);
+        if (verify_same(emulator, reference)) break;
+
+        memcpy(&snapshots[VERIFY_AGREED], &snapshots[VERIFY_MIDDLE], 2 * sizeof(struct VerifySnapshot));
+        budget -= half;
+    }
+
+    verify_restore_both(&snapshots[VERIFY_AGREED], emulator, reference);
+    return verify_step(emulator, reference, budget, listed);
+}
+
+bool emulator_verify_run(struct Emulator *emulator, uint64_t max_frames, uint64_t interval, FILE *output) {
+    struct Emulator *reference = malloc(sizeof(struct Emulator));
+    struct VerifySnapshot *snapshots = malloc(VERIFY_SNAPSHOTS * sizeof(struct VerifySnapshot));
+    if (!reference || !snapshots || !emulator_initialize(reference)) {
+        fprintf(stderr, "Could not create the reference emulator\n");
+        free(snapshots);
+        free(reference);
+        return false;
+    }
+
+    // Same machine and speed; inputs (movie keypad) are copied from the emulator each frame
+    reference->emulated_system = emulator->emulated_system;
+    reference->extension = emulator->extension;
+    reference->instructions_per_second = emulator->instructions_per_second;
+    reference->instruction_remainder = emulator->instruction_remainder;
+    reference->instructions_executed = emulator->instructions_executed;
+    reference->cpu = CPU_INTERPRETER;
+    reference->skip_idle_loops = false;
+
+    struct VerifiedInstruction listed[VERIFY_LISTED_INSTRUCTIONS], diverged_listed[VERIFY_LISTED_INSTRUCTIONS];
+    uint64_t frames = 0, comparisons = 0;
+    bool same = true;
+
+    while (same && emulator->emulated_system.state != QUIT && (max_frames == 0 || frames < max_frames)) {
+        emulator_begin_frame(emulator);
+        emulator_begin_frame(reference);
+        memcpy(reference->emulated_system.keypad, emulator->emulated_system.keypad, sizeof reference->emulated_system.keypad);
+
+        while (emulator->frame_instructions_left > 0 && emulator->emulated_system.state != QUIT) {
+            const uint64_t count = interval != 0 && interval < emulator->frame_instructions_left ? interval : emulator->frame_instructions_left;
+
+            verify_take_both(&snapshots[VERIFY_AGREED], emulator, reference);
+            const uint64_t diverged_run = verify_step(emulator, reference, count, listed);
+            comparisons++;
+            if (verify_same(emulator, reference)) continue;
+
+            same = false;
+            const uint64_t frame = emulator->frames_executed;
+            verify_take_both(&snapshots[VERIFY_DIVERGED], emulator, reference);
+            memcpy(diverged_listed, listed, sizeof listed);
+
+            const uint64_t run = verify_bisect(emulator, reference, snapshots, count, listed);
+            if (!verify_same(emulator, reference)) {
+                verify_report(output, emulator, reference, listed, run, frame);
+            }
+            else {
+                // Replaying with fresh caches hides it: most likely code that was not invalidated after a RAM write
+                verify_restore_both(&snapshots[VERIFY_DIVERGED], emulator, reference);
+                verify_report(output, emulator, reference, diverged_listed, diverged_run, frame);
+                fprintf(output, "  (not reproduced when replayed with decoded and compiled code dropped: stale cached code?)\n");
+            }
+            break;
+        }
+        if (!same) break;
+
+        // Timers, on both
+        emulator_end_frame(emulator);
+        emulator_end_frame(reference);
+        frames++;
+    }
+
+    if (same) {
+        fprintf(output, "verify: %llu frames, %llu instructions (%llu idle skipped), %llu comparisons, ",
+                (long long unsigned)frames, (long long unsigned)emulator->instructions_executed,
+                (long long unsigned)emulator->instructions_skipped, (long long unsigned)comparisons);
+        if (interval != 0) fprintf(output, "every %llu instructions, no divergence\n", (long long unsigned)interval);
+        else fprintf(output, "once per frame, no divergence\n");
+    }
+    emulator_destroy(reference);
+    free(reference);
+    free(snapshots);
+    return same;
+}